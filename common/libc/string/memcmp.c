@@ -27,7 +27,17 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * This file is shared between libc and the kernel, so don't put anything
+ * in here that won't work in both contexts.
+ */
+
+#ifdef _KERNEL
+#include <types.h>
+#include <lib.h>
+#else
 #include <string.h>
+#endif
 
 /*
  * Standard C string function: compare two memory blocks and return
@@ -66,6 +66,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 
 /*
@@ -104,18 +105,48 @@ paddr_t ram_stealmem(unsigned long npages);
 void ram_getsize(paddr_t *lo, paddr_t *hi);
 void switchTocoremap(void);
 
+/*
+ * Page tables.
+ *
+ * Each address space has a two-level page table covering all of user
+ * space. The top bits of a user address index a directory of
+ * PT_DIRENTRIES pointers to leaf tables (NULL for none); the next bits
+ * index a leaf of PT_LEAFENTRIES one-word entries. Above the low byte
+ * an entry is laid out like entryLo, and the UTLB miss handler in
+ * exception-mips1.S loads it straight into the TLB without calling
+ * vm_fault; entries without TLBLO_VALID go to vm_fault as usual. The
+ * low byte belongs to the VM system. Directory and leaves must live
+ * in kseg0.
+ *
+ * cpupagetables[] holds the directory of the address space active on
+ * each cpu, indexed by cpu number like cpustacks[].
+ *
+ * The assembly code knows these numbers; change both together.
+ */
+#define PT_DIRSHIFT     22
+#define PT_LEAFSHIFT    12
+#define PT_DIRENTRIES   (USERSPACETOP >> PT_DIRSHIFT)
+#define PT_LEAFENTRIES  1024
+#define PT_DIRINDEX(va)  ((va) >> PT_DIRSHIFT)
+#define PT_LEAFINDEX(va) (((va) >> PT_LEAFSHIFT) & (PT_LEAFENTRIES - 1))
+
+extern vaddr_t cpupagetables[];
+
 /*
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * Each one carries up to TLBSHOOTDOWN_PAGES pages of one address
+ * space, so a batch of pages costs a single IPI.
  */
 
+#define TLBSHOOTDOWN_PAGES 8
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
 	struct addrspace *ts_addrspace;
-	vaddr_t ts_vaddr;
+	vaddr_t ts_vaddrs[TLBSHOOTDOWN_PAGES];
+	unsigned ts_npages;
+	struct semaphore *ts_done;	/* if not NULL, V'd once done */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -35,6 +35,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <copyinout.h>
 #include "opt-A2.h"
 #include "opt-A3.h"
 /*
@@ -81,6 +82,10 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_A3
+	int fd;
+	off_t offset;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -146,6 +151,35 @@ syscall(struct trapframe *tf)
 			sys_kill((int)tf->tf_a0);
 			panic("unexpected return from sys_kill");
 			break;
+
+		case SYS_sbrk:
+			err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+			break;
+
+		case SYS_mmap:
+			//the fd and the (64-bit, aligned) offset are on the user stack
+			err = copyin((const_userptr_t)(tf->tf_sp + 16), &fd, sizeof(int));
+			if (err == 0) {
+				err = copyin((const_userptr_t)(tf->tf_sp + 24), &offset, sizeof(off_t));
+			}
+			if (err == 0) {
+				err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+					       (int)tf->tf_a2, (int)tf->tf_a3, fd, offset,
+					       (vaddr_t *)&retval);
+			}
+			break;
+
+		case SYS_munmap:
+			err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+			break;
+
+		case SYS_msync:
+			err = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2);
+			break;
+
+		case SYS_getvmstat:
+			err = sys_getvmstat((userptr_t)tf->tf_a0);
+			break;
 #endif
 		default:
 			kprintf("Unknown syscall %d\n", callno);
@@ -59,6 +59,13 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Page table of the address space active on each cpu, for the UTLB
+ * miss handler; 0 if there isn't one. The VM system keeps it up to
+ * date. See <machine/vm.h>.
+ */
+vaddr_t cpupagetables[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
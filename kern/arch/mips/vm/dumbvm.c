@@ -38,6 +38,27 @@
 #include <addrspace.h>
 #include <vm.h>
 #include "opt-A3.h"
+#if OPT_A3
+#include <uio.h>
+#include <vnode.h>
+#include <synch.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <coremap.h>
+#include <swap.h>
+#include <zeropool.h>
+#include <textcache.h>
+#include <ksm.h>
+#include <pageout.h>
+#include <compact.h>
+#include <wset.h>
+#include <uw-vmstats.h>
+#include <platform/maxcpus.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <kern/vmstat.h>
+#include <array.h>
+#endif
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
  * enough to struggle off the ground.
@@ -46,6 +67,11 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+#if OPT_A3
+/* the stack starts at DUMBVM_STACKPAGES and grows on demand up to this (4M) */
+#define DUMBVM_STACKLIMIT    1024
+#endif
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
@@ -53,138 +79,225 @@ static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
 #if OPT_A3
 
-void alloc_coremap(void);
+/*
+ * Page table entries are single words in the two-level table described
+ * in <machine/vm.h>. The top half and the TLBLO_ bits are laid out the
+ * way the TLB wants them, so the UTLB handler can load an entry as it
+ * is; the low byte is ours (the handler masks it off).
+ *
+ *    PTE_FRAME     the frame if PTE_RESIDENT, the swap slot (shifted
+ *                  up by PTE_SLOTSHIFT) if PTE_SWAPPED
+ *    TLBLO_DIRTY   writes may go through the TLB entry
+ *    TLBLO_VALID   the UTLB handler may load the entry. Cleared while
+ *                  the page is busy, and by the clock so that the next
+ *                  miss comes to vm_fault and marks it referenced
+ *    PTE_RESIDENT  in memory
+ *    PTE_READONLY  in a read-only region (text, once it's loaded)
+ *    PTE_COW       frame is shared with another address space since
+ *                  fork, copy it before writing
+ *    PTE_SWAPPED   not in memory, contents are in swap
+ *    PTE_BUSY      being paged in or out right now, wait on vm_wchan
+ *                  until it's done
+ *    PTE_CACHED    frame belongs to the text cache, shared with every
+ *                  other process running the same program
+ *    PTE_MODIFIED  written since it was last written back to the file
+ *                  (shared file mappings only, whose clean pages are
+ *                  mapped without TLBLO_DIRTY so the first write shows)
+ *    PTE_CLEAN     the frame is exactly what as_load_page would read
+ *                  back from the file, so eviction can just drop it.
+ *                  Goes as soon as the page is mapped TLBLO_DIRTY
+ *
+ * A zero entry is a page that has never been touched.
+ */
+#define PTE_FRAME      TLBLO_PPAGE
+#define PTE_SLOTSHIFT  12
+#define PTE_RESIDENT   0x00000080
+#define PTE_READONLY   0x00000040
+#define PTE_COW        0x00000020
+#define PTE_SWAPPED    0x00000010
+#define PTE_BUSY       0x00000008
+#define PTE_CACHED     0x00000004
+#define PTE_MODIFIED   0x00000002
+#define PTE_CLEAN      0x00000001
+#define PTE_SWBITS     0x000000ff
+
+//give up looking for a victim after this many turn out to be unusable
+#define VM_EVICT_TRIES 8
+
+//most neighbouring pages vm_fault will map along with the one that faulted
+#define VM_FAULTAROUND_MAX 8
+
+//most mappings of a text frame vm_reclaim_text unmaps per pass over vm_aslist
+#define VM_RECLAIM_BATCH 16
+
+static struct wchan *vm_wchan; //for threads waiting on a busy page table entry
+static struct lock *evict_lock; //one eviction at a time
+static struct lock *shootdown_lock; //one shootdown at a time, so the per-cpu queues can't overflow
+static struct semaphore *shootdown_sem; //other cpus V this once they've dropped the entries
+static struct spinlock vm_aslist_lock = SPINLOCK_INITIALIZER; //before any as_lock
+static struct addrspace *vm_aslist; //every address space not yet being destroyed
 
-int *coremap;
-paddr_t firstFrameAddr;
-int noOfFrames;
-bool coreFormed = false;
+/*
+ * One frame of zeros, mapped copy-on-write for reads of anonymous pages
+ * nobody has written yet. It is reserved in the coremap for good, and
+ * its mappings aren't reference-counted: nothing takes or drops a
+ * reference to it, however many address spaces map it, and a write
+ * always gets a frame of its own.
+ */
+static paddr_t vm_zeroframe;
 
-struct pageTableEntry {
-  paddr_t frameBasePhysAddr;
-};
+/*
+ * Per-cpu ASID allocation, indexed by cpu number like cpustacks[]. An
+ * address space's tag for a cpu (as_asid[cpu]) is only good while its
+ * generation matches; ASID 0 is never handed out.
+ */
+static uint32_t asid_generation[MAXCPUS];
+static uint32_t asid_next[MAXCPUS];
 
-void alloc_coremap(void) {
-	paddr_t minPhysAddr = 0;
-	paddr_t maxPhysAddr = 0;
+/*
+ * Per-cpu shadow of the TLB: which slots hold an entry, and which have
+ * been referenced since the replacement hand last went by. It lets
+ * vm_fault find a free slot without reading the TLB back, and replace
+ * with second chance instead of tlb_random. The TLB keeps no reference
+ * bits, so an entry counts as referenced when vm_fault loads or
+ * upgrades it; fault-around entries start out unreferenced.
+ *
+ * The UTLB handler's tlbwr can overwrite slots 8-63 without updating
+ * the shadow, so it is only a hint. That's safe: every entry is probed
+ * for before it's written, so the worst a stale hint does is throw
+ * out an entry the handler loaded.
+ */
+struct tlbshadow {
+	uint64_t ts_used;
+	uint64_t ts_ref;
+	unsigned ts_hand;
+};
+static struct tlbshadow tlbshadow[MAXCPUS];
 
-	//first get the minPhysAddr and maxPhysAddr
-	ram_getsize(&minPhysAddr, &maxPhysAddr);
+#define TLBSHADOW_BIT(i) ((uint64_t)1 << (i))
 
-	//finding possible no of Frames 
-	noOfFrames = (maxPhysAddr - minPhysAddr) / PAGE_SIZE;	
+/*
+ * How long vm_fault takes, for the whole system, bucketed like
+ * vs_faulthist in <kern/vmstat.h>. Each address space keeps its own
+ * histogram as well, in as_vmstat.
+ */
+static unsigned vm_faulthist[VS_HISTBUCKETS];
+static struct spinlock vm_faulthist_lock = SPINLOCK_INITIALIZER;
 
-	//then steal memory for coremap 
-	coremap = kmalloc(sizeof (int) * noOfFrames);	
+#endif //OPT_A3
 
-	//get info about firstFrameAddr that is going to be allocated by the kernel
-	ram_getsize(&firstFrameAddr, &maxPhysAddr);
+void
+vm_bootstrap(void)
+{
+	#if OPT_A3
+	coremap_bootstrap();
+	zeropool_bootstrap();
+	vmstats_init();
 
-	//round up the firstFrameAddr so that it is a multiple of PAGE_SIZE
-	while(firstFrameAddr % PAGE_SIZE != 0) {
-		firstFrameAddr = firstFrameAddr + 1;
+	vm_zeroframe = coremap_alloc(1);
+	if (vm_zeroframe == 0) {
+		panic("vm_bootstrap: out of memory\n");
+	}
+	bzero((void *)PADDR_TO_KVADDR(vm_zeroframe), PAGE_SIZE);
+	coremap_reserve(vm_zeroframe);
+
+	vm_wchan = wchan_create("vm");
+	evict_lock = lock_create("evict");
+	shootdown_lock = lock_create("shootdown");
+	shootdown_sem = sem_create("shootdown", 0);
+	if (vm_wchan == NULL || evict_lock == NULL || shootdown_lock == NULL ||
+	    shootdown_sem == NULL) {
+		panic("vm_bootstrap: out of memory\n");
 	}
 
-	//initialize coremap to be all empty
-	for (int i = 0; i < noOfFrames; ++i) {
-
-		coremap[i] = 0; 
-
-		if (firstFrameAddr + i * PAGE_SIZE > maxPhysAddr) {
-			//some issues might arise because of coremap needing multiple pages, this block takes care of it
-			//since we never want to access these out of bounds entries we can just reduce noOfFrames! Neat :D
-			noOfFrames = noOfFrames - 1;
-			kprintf("Out of bounds memory found during coremap initialisation, reduce noOfFrames \n");
-		}		
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		asid_generation[i] = 0;
+		asid_next[i] = 1;
 	}
-	
-	//set coreFormed to be true as coremap is now formed and ready to go!
-	coreFormed = true;
 
-	//finally switch to coremap and start using it!
-	switchTocoremap();
+	swap_bootstrap();
+	pageout_bootstrap();
+	compact_bootstrap();
+	wset_bootstrap();
+	#endif
 }
 
-#endif //OPT_A3
 
-void
-vm_bootstrap(void)
+#if OPT_A3
+/*
+ * Whether getppages can stop to compact memory or page things out: not
+ * in an interrupt, holding no spinlocks, and not in the middle of
+ * paging something.
+ */
+static
+bool
+vm_may_compact(void)
 {
-	#if OPT_A3
-	alloc_coremap();	
-	#endif
+	return curthread->t_curspl == 0 && !curthread->t_in_interrupt &&
+		evict_lock != NULL && !lock_do_i_hold(evict_lock) &&
+		shootdown_lock != NULL && !lock_do_i_hold(shootdown_lock);
 }
-
+#endif //OPT_A3
 
 static
 paddr_t
 getppages(unsigned long npages)
 {
 	paddr_t addr;
-	spinlock_acquire(&stealmem_lock);
 	#if OPT_A3
-	if (!coreFormed) {
-		addr = ram_stealmem(npages);
-	}
-	else {
-
-		int noOfPagesRequired = (int)npages;
-		//kprintf("Allocate: %d frames\n", noOfPagesRequired);
-		bool memBlockFound = false;
-		int startingFrame;
-
-		for (int i = 0; i < noOfFrames; ++i) {
-			if(coremap[i] == 0) { //checking if coremap at i is empty
-
-				startingFrame = i;
-				int noOfPagesFound = 1;
-
-				if (noOfPagesRequired > 1) { //checking if we need more than 1 Frame to allocate the Pages
-					for (int j = i + 1; j < noOfFrames; ++j) {
-						if (coremap[j] == 0) { //checking if coremap at j is empty
-
-							++noOfPagesFound;
-
-							if (noOfPagesFound == noOfPagesRequired) { //checking if we hit the target of noOfPagesRequired
-								memBlockFound = true;
-								break;
-							}
-						}
-						else { //uncontiguous memory detected (coremap[j] != 0), have to restart the search at j+1 :(
-							i = j + 1;
-							break;
-						}
-					}
-				}
-				else { //found 1 block of memory when we needed only 1 block of memory!!
-					memBlockFound = true;
-				}
-				if (memBlockFound) { //if memBlockFound then we can exit outer loop
-					break;
-				}
-			}
+	unsigned i;
+	bool clean;
+
+	if (coremap_isready()) {
+		addr = coremap_alloc(npages);
+		pageout_check();
+		if (addr == 0 && zeropool_drain() > 0) {
+			addr = coremap_alloc(npages);
 		}
-		if (memBlockFound) {
-			for (int i = 0; i < noOfPagesRequired; ++i) {
-				coremap[startingFrame + i] = i + 1;
-				//kprintf("Allocate: Set frame %d with address: 0x%x to %d\n", startingFrame + i,firstFrameAddr + ((startingFrame+i) * PAGE_SIZE) , i+1);
+		if (addr == 0 && npages > 1 && vm_may_compact()) {
+			//enough may be free, just not in one piece
+			addr = compact_alloc(npages);
+		}
+		if (addr == 0 && vm_may_compact()) {
+			//the page-out daemon didn't keep up, so free some user pages ourselves
+			for (i = 0; i < npages && vm_pageout(&clean); i++) {
+				vmstats_inc(VMSTAT_PAGEOUT_DIRECT);
+			}
+			addr = coremap_alloc(npages);
+			if (addr == 0 && npages > 1) {
+				addr = compact_alloc(npages);
 			}
-			addr = firstFrameAddr + (startingFrame * PAGE_SIZE);
 		}
-		else {
-			spinlock_release(&stealmem_lock);
-			kprintf("Ran out of memory trying to allocate %lu frames\n", npages);
-			for (int i = 0; i < noOfFrames; ++i) {
-				kprintf("Frame Number: %d, Frame Value: %d\n", i, coremap[i]);
+		if (addr == 0) {
+			DEBUG(DB_VM, "dumbvm: out of memory allocating %lu frames\n", npages);
+			if (dbflags & DB_VM) {
+				coremap_dump();
 			}
-			return ENOMEM;
 		}
+		return addr;
 	}
 	#endif //OPT_A3
+	spinlock_acquire(&stealmem_lock);
+	addr = ram_stealmem(npages);
 	spinlock_release(&stealmem_lock);
 	return addr;
 }
 
+#if OPT_A3
+/*
+ * Give back frames obtained from getppages.
+ */
+static
+void
+freeppages(paddr_t paddr)
+{
+	if (paddr == 0 || !coremap_isready()) {
+		return;
+	}
+	coremap_free(paddr);
+}
+#endif //OPT_A3
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t 
 alloc_kpages(int npages)
@@ -194,11 +307,6 @@ alloc_kpages(int npages)
 	if (pa==0) {
 		return 0;
 	}
-	#if OPT_A3
-	else if(pa == ENOMEM) {
-		return ENOMEM;
-	}
-	#endif //OPT_A3
 	return PADDR_TO_KVADDR(pa);
 }
 
@@ -206,248 +314,1896 @@ void
 free_kpages(vaddr_t addr)
 {
 	#if OPT_A3
-	spinlock_acquire(&stealmem_lock);
-	if (coreFormed) {
-		if (!addr) {
-			kprintf("Error while freeing");
-			spinlock_release(&stealmem_lock);
-			return;
-		}
-		int currentFrame = (addr - firstFrameAddr)/PAGE_SIZE;
-		if (currentFrame >= noOfFrames) { //got a stack address
-			addr = PADDR_TO_KVADDR(addr);
-			//kprintf("got stack address, normal address is 0x%x\n", addr);
-			currentFrame = (addr - firstFrameAddr)/PAGE_SIZE;
-		}
-		int previousFrameStatus = coremap[currentFrame];
-		//KASSERT(previousFrameStatus == 1);
-		coremap[currentFrame] = 0;
-		//kprintf("Delete: Set First Frame %d to 0\n", currentFrame);
-		while (currentFrame + 1 < noOfFrames) {
-			currentFrame = currentFrame + 1;
-			int currentFrameStatus = coremap[currentFrame];
-			if (currentFrameStatus == previousFrameStatus + 1) {
-				previousFrameStatus = currentFrameStatus;
-				coremap[currentFrame] = 0;
-				//kprintf("Delete: Set Frame %d to 0\n", currentFrame);
-			}
-			else {
-				//kprintf("Delete: Set Last Frame %d to 0\n", currentFrame - 1);
-				break;
-			}
-		}
-	}
-		
-	spinlock_release(&stealmem_lock);
+	KASSERT(addr >= MIPS_KSEG0);
+	freeppages(KVADDR_TO_PADDR(addr));
+	#else
+	/* nothing - leak the memory. */
+	(void)addr;
 	#endif
 }
 
+#if OPT_A3
+int
+alloc_kpages_batch(unsigned npages, vaddr_t *addrs)
+{
+	int result;
+
+	/* paddr_t and vaddr_t are the same width; convert in place. */
+	result = coremap_alloc_batch(npages, (paddr_t *)addrs);
+	if (result) {
+		return result;
+	}
+	for (unsigned i = 0; i < npages; ++i) {
+		addrs[i] = PADDR_TO_KVADDR(addrs[i]);
+	}
+	return 0;
+}
+
 void
-vm_tlbshootdown_all(void)
+free_kpages_batch(const vaddr_t *addrs, unsigned npages)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	paddr_t frames[32];
+	unsigned n;
+
+	while (npages > 0) {
+		n = npages < 32 ? npages : 32;
+		for (unsigned i = 0; i < n; ++i) {
+			KASSERT(addrs[i] >= MIPS_KSEG0);
+			frames[i] = KVADDR_TO_PADDR(addrs[i]);
+		}
+		coremap_free_batch(frames, n);
+		addrs += n;
+		npages -= n;
+	}
 }
+#endif //OPT_A3
 
+/*
+ * Throw away every mapping in this CPU's TLB.
+ */
+static
 void
-vm_tlbshootdown(const struct tlbshootdown *ts)
+tlb_invalidate_all(void)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	#if OPT_A3
+	tlbshadow[curcpu->c_number].ts_used = 0;
+	tlbshadow[curcpu->c_number].ts_ref = 0;
+	#endif
+
+	splx(spl);
 }
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
+#if OPT_A3
+/*
+ * This CPU's ASID for AS, or 0 if it hasn't got one in the current
+ * generation. Call with interrupts off.
+ */
+static
+uint32_t
+as_asid_lookup(struct addrspace *as)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
-	struct addrspace *as;
-	int spl;
-	bool isCodeSegment = false;
+	unsigned cpu = curcpu->c_number;
+	uint32_t tag = as->as_asid[cpu];
 
-	faultaddress &= PAGE_FRAME;
+	if (tag / NUM_TLBPID != asid_generation[cpu]) {
+		return 0;
+	}
+	return tag % NUM_TLBPID;
+}
 
-	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+/*
+ * This CPU's ASID for AS, handing out a fresh one if it needs it. When
+ * they run out the whole TLB is flushed and a new generation starts,
+ * which retires every address space's old tag at once. Call with
+ * interrupts off.
+ */
+static
+uint32_t
+as_asid_assign(struct addrspace *as)
+{
+	unsigned cpu = curcpu->c_number;
+	uint32_t asid;
 
-	switch (faulttype) {
-	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		//panic("dumbvm: got VM_FAULT_READONLY\n");
-				return 1;
-	    case VM_FAULT_READ:
-	    case VM_FAULT_WRITE:
-		break;
-	    default:
-		return EINVAL;
+	asid = as_asid_lookup(as);
+	if (asid != 0) {
+		return asid;
 	}
 
-	if (curproc == NULL) {
-		/*
-		 * No process. This is probably a kernel fault early
-		 * in boot. Return EFAULT so as to panic instead of
-		 * getting into an infinite faulting loop.
-		 */
-		return EFAULT;
+	if (asid_next[cpu] == NUM_TLBPID) {
+		tlb_invalidate_all();
+		asid_generation[cpu]++;
+		asid_next[cpu] = 1;
 	}
+	asid = asid_next[cpu]++;
+	as->as_asid[cpu] = asid_generation[cpu] * NUM_TLBPID + asid;
+	return asid;
+}
 
-	as = curproc_getas();
-	if (as == NULL) {
-		/*
-		 * No address space set up. This is probably also a
-		 * kernel fault early in boot.
-		 */
-		return EFAULT;
+/*
+ * Drop this CPU's mapping of VADDR in AS, if it has one.
+ */
+static
+void
+tlb_invalidate_page(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t asid;
+	int i, spl;
+
+	spl = splhigh();
+	asid = as_asid_lookup(as);
+	if (asid != 0) {
+		i = tlb_probe((vaddr & PAGE_FRAME) | (asid << TLBHI_PIDSHIFT), 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			tlbshadow[curcpu->c_number].ts_used &= ~TLBSHADOW_BIT(i);
+			tlbshadow[curcpu->c_number].ts_ref &= ~TLBSHADOW_BIT(i);
+			vmstats_inc(VMSTAT_TLB_INVALIDATE);
+		}
 	}
+	splx(spl);
+}
 
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	//KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	//KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
-	//KASSERT(as->as_stackpbase != 0);
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	//KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-	//KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-	//KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	//TODO
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-
-		vaddr_t offset = (faultaddress - vbase1);
-        vaddr_t pageNum = offset / PAGE_SIZE;
-        paddr = as->as_pageTable1[pageNum].frameBasePhysAddr;		
-	
-		isCodeSegment = true;
+/*
+ * Load an entry into this CPU's TLB that isn't there already. Takes a
+ * free slot if the shadow knows of one, else the first slot past the
+ * hand that hasn't been referenced since the hand last passed it.
+ * Returns true if a free slot was used. Call with interrupts off.
+ */
+static
+bool
+tlb_shadow_write(uint32_t ehi, uint32_t elo, bool referenced)
+{
+	struct tlbshadow *ts = &tlbshadow[curcpu->c_number];
+	bool wasfree;
+	unsigned i;
+
+	KASSERT(tlb_probe(ehi, 0) < 0);
+
+	wasfree = ts->ts_used != ~(uint64_t)0;
+	if (wasfree) {
+		for (i = 0; ts->ts_used & TLBSHADOW_BIT(i); i++) {
+			/* nothing */
+		}
 	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		vaddr_t offset = (faultaddress - vbase2);
-        vaddr_t pageNum = offset / PAGE_SIZE;
-        paddr = as->as_pageTable2[pageNum].frameBasePhysAddr;	
+	else {
+		//every slot's bit is cleared on the first lap, so this ends
+		while (ts->ts_ref & TLBSHADOW_BIT(ts->ts_hand)) {
+			ts->ts_ref &= ~TLBSHADOW_BIT(ts->ts_hand);
+			ts->ts_hand = (ts->ts_hand + 1) % NUM_TLB;
+		}
+		i = ts->ts_hand;
+		ts->ts_hand = (ts->ts_hand + 1) % NUM_TLB;
 	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		vaddr_t offset = (faultaddress - stackbase);
-        vaddr_t pageNum = offset / PAGE_SIZE;
-        paddr = as->as_pageTableStack[pageNum].frameBasePhysAddr;	
+
+	tlb_write(ehi, elo, i);
+	ts->ts_used |= TLBSHADOW_BIT(i);
+	if (referenced) {
+		ts->ts_ref |= TLBSHADOW_BIT(i);
 	}
 	else {
-		return EFAULT;
+		ts->ts_ref &= ~TLBSHADOW_BIT(i);
 	}
+	return wasfree;
+}
 
-	/* make sure it's page-aligned */
-	KASSERT((paddr & PAGE_FRAME) == paddr);
+/*
+ * Take AS's ASIDs away on every other cpu: its old TLB entries there
+ * can never match again, and it gets a fresh ASID if it runs there
+ * later. Only for the current thread's address space, which nobody
+ * else can be activating at the same time.
+ */
+static
+void
+as_asid_retire_others(struct addrspace *as)
+{
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		if (i != curcpu->c_number) {
+			as->as_asid[i] = 0;
+		}
+	}
+}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+/*
+ * The page table entry for VADDR in AS, or NULL if nothing in its leaf
+ * has been touched yet. Leaves stay put until as_destroy, so the
+ * pointer can be kept after the address space lock is dropped.
+ */
+static
+uint32_t *
+as_pte_lookup(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t *leaf;
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
+	KASSERT(vaddr < USERSPACETOP);
+	leaf = as->as_pagedir[PT_DIRINDEX(vaddr)];
+	if (leaf == NULL) {
+		return NULL;
+	}
+	return &leaf[PT_LEAFINDEX(vaddr)];
+}
+#endif //OPT_A3
+
+bool
+vm_idle(void)
+{
+	#if OPT_A3
+	return zeropool_fill();
+	#else
+	return false;
+	#endif
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	#if OPT_A3
+	tlb_invalidate_all();
+	#else
+	panic("dumbvm tried to do tlb shootdown?!\n");
+	#endif
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	#if OPT_A3
+	for (unsigned i = 0; i < ts->ts_npages; i++) {
+		tlb_invalidate_page(ts->ts_addrspace, ts->ts_vaddrs[i]);
+	}
+	if (ts->ts_done != NULL) {
+		V(ts->ts_done);
+	}
+	#else
+	(void)ts;
+	panic("dumbvm tried to do tlb shootdown?!\n");
+	#endif
+}
+
+#if OPT_A3
+/*
+ * The cpus that may hold TLB entries for AS: those where it has an
+ * ASID in the current generation. Any other cpu either never ran it,
+ * had its ASID retired, or has flushed its TLB since. A cpu that picks
+ * up a fresh ASID after this looks can only load entries from the page
+ * table as it is now, so callers update the page table first.
+ */
+static
+uint32_t
+as_cpumask(struct addrspace *as)
+{
+	uint32_t mask = 0;
+	uint32_t tag;
+
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		tag = as->as_asid[i];
+		if (tag % NUM_TLBPID != 0 && tag / NUM_TLBPID == asid_generation[i]) {
+			mask |= (uint32_t)1 << i;
+		}
+	}
+	return mask;
+}
+
+/*
+ * Make sure no CPU has any of the NPAGES pages at VADDRS in AS mapped
+ * any more, and wait until they're all done. Pages go out
+ * TLBSHOOTDOWN_PAGES to an IPI, and only to the cpus as_cpumask picks.
+ * One shootdown at a time, so a cpu never has more than one queued
+ * and the queue can't overflow into a full flush (which would lose the
+ * semaphore).
+ */
+static
+void
+vm_shootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned npages)
+{
+	struct tlbshootdown ts;
+	unsigned n, i;
+	int spl;
+
+	lock_acquire(shootdown_lock);
+	while (npages > 0) {
+		ts.ts_addrspace = as;
+		ts.ts_npages = npages < TLBSHOOTDOWN_PAGES ? npages : TLBSHOOTDOWN_PAGES;
+		for (i = 0; i < ts.ts_npages; i++) {
+			ts.ts_vaddrs[i] = vaddrs[i];
 		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		#if OPT_A3
-		if ((as->loadelfcompleted == true) && (isCodeSegment)) {
-			elo &= ~TLBLO_DIRTY;
+		ts.ts_done = shootdown_sem;
+
+		/* Stay on this CPU while we do our own TLB. */
+		spl = splhigh();
+		n = ipi_tlbshootdown_mask(&ts, as_cpumask(as));
+		for (i = 0; i < ts.ts_npages; i++) {
+			tlb_invalidate_page(as, ts.ts_vaddrs[i]);
 		}
-		#endif
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
 		splx(spl);
-		return 0;
+
+		vmstats_inc(VMSTAT_TLB_SHOOTDOWN);
+		for (i = 0; i < n; i++) {
+			vmstats_inc(VMSTAT_TLB_SHOOTDOWN_IPI);
+			P(shootdown_sem);
+		}
+
+		vaddrs += ts.ts_npages;
+		npages -= ts.ts_npages;
 	}
-	#if OPT_A3
-	//kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	ehi = faultaddress;
-	elo = paddr|TLBLO_DIRTY | TLBLO_VALID;
-	if ((as->loadelfcompleted == true) && (isCodeSegment)) {
-    elo &= ~TLBLO_DIRTY;
-  } 
-	tlb_random(ehi,elo);
-	splx(spl);
-	return 0;
-	#endif
+	lock_release(shootdown_lock);
 }
 
-struct addrspace *
-as_create(void)
+/*
+ * Wait for PTE to stop being busy. Called and returns with the address
+ * space lock held.
+ */
+static
+void
+as_wait_pte(struct addrspace *as, uint32_t *pte)
 {
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
-	if (as==NULL) {
-		return NULL;
+	KASSERT(spinlock_do_i_hold(&as->as_lock));
+
+	while (*pte & PTE_BUSY) {
+		wchan_lock(vm_wchan);
+		spinlock_release(&as->as_lock);
+		wchan_sleep(vm_wchan);
+		spinlock_acquire(&as->as_lock);
 	}
+}
+
+/*
+ * The first region containing VADDR, or NULL if it isn't in any.
+ * Regions only change under the address space's own thread, so no
+ * lock is needed to look at them.
+ */
+static
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *r;
+
+	for (r = as->as_regions; r != NULL && r->rg_vbase <= vaddr; r = r->rg_next) {
+		if (vaddr - r->rg_vbase < r->rg_npages * PAGE_SIZE) {
+			return r;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Whether the page at VADDR may be written. ELF segments can share a
+ * page, in which case any writable one makes the page writable.
+ */
+static
+bool
+as_page_writeable(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *r;
+
+	for (r = as->as_regions; r != NULL && r->rg_vbase <= vaddr; r = r->rg_next) {
+		if (vaddr - r->rg_vbase < r->rg_npages * PAGE_SIZE && r->rg_writeable) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Whether changes to R's pages go back to a file: a MAP_SHARED mapping
+ * of one.
+ */
+static
+bool
+as_region_writesback(const struct region *r)
+{
+	return (r->rg_mapflags & MAP_SHARED) != 0 && r->rg_backing.vnode != NULL;
+}
+
+/*
+ * The page table entry for VADDR in AS if it is still the only mapping
+ * of frame PADDR, which the caller has pinned, returned with the
+ * address space lock held. NULL (with the lock not held) if the page
+ * has changed hands since the coremap looked at it.
+ */
+static
+uint32_t *
+vm_victim_pte(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	uint32_t *pte = as_pte_lookup(as, vaddr);
+
+	spinlock_acquire(&as->as_lock);
+	if (pte == NULL || (*pte & (PTE_RESIDENT | PTE_BUSY)) != PTE_RESIDENT ||
+	    (*pte & PTE_FRAME) != paddr || coremap_refcount(paddr) != 1) {
+		spinlock_release(&as->as_lock);
+		return NULL;
+	}
+	return pte;
+}
+
+/*
+ * Push the page at VADDR in AS out of frame PADDR to swap, or drop it
+ * if it's a clean copy of a file page, setting *CLEAN. PTE is as
+ * vm_victim_pte handed it back, with the address space lock held;
+ * called with evict_lock held too, and returns with only that. Hands
+ * back PADDR, now the caller's, or 0 if there was nowhere to put the
+ * page.
+ */
+static
+paddr_t
+vm_evict_page(struct addrspace *as, uint32_t *pte, vaddr_t vaddr,
+	      paddr_t paddr, bool *clean)
+{
+	unsigned slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(evict_lock));
+
+	//no more refills, then get rid of the TLB entries already out there
+	*pte = (*pte | PTE_BUSY) & ~TLBLO_VALID;
+	spinlock_release(&as->as_lock);
+
+	vm_shootdown(as, &vaddr, 1);
+
+	*clean = (*pte & PTE_CLEAN) != 0;
+	if (*clean) {
+		//the next fault reads it back from the file
+		spinlock_acquire(&as->as_lock);
+		*pte = 0;
+		wchan_wakeall(vm_wchan);
+		spinlock_release(&as->as_lock);
+		coremap_unpin(paddr, true);
+		vmstats_inc(VMSTAT_PAGEOUT_CLEAN);
+		return paddr;
+	}
+
+	result = swap_alloc(&slot);
+	if (result == 0) {
+		KASSERT(slot <= PTE_FRAME >> PTE_SLOTSHIFT);
+		result = swap_out(paddr, slot);
+		if (result) {
+			swap_free(slot);
+		}
+	}
+
+	spinlock_acquire(&as->as_lock);
+	if (result == 0) {
+		*pte = (slot << PTE_SLOTSHIFT) | PTE_SWAPPED | (*pte & PTE_MODIFIED);
+	}
+	else {
+		*pte &= ~PTE_BUSY;
+	}
+	wchan_wakeall(vm_wchan);
+	spinlock_release(&as->as_lock);
+
+	coremap_unpin(paddr, result == 0);
+	//if it failed, swap is full (or broken), nothing more to be done
+	return result ? 0 : paddr;
+}
+
+/*
+ * Take a frame back from the text cache: PADDR, or if that's 0
+ * whichever one textcache_reclaim comes to next. Once it's out of the
+ * cache nothing new can map it, so every address space that has it
+ * mapped gets the entry cleared, to be read back from the file on its
+ * next use, and its reference dropped. Entries are marked busy before
+ * vm_aslist_lock is let go, which holds off as_destroy until we're
+ * done with them. Hands back the frame, now the caller's alone, or 0
+ * if there was none or somebody still has a reference: a fault that
+ * looked it up before it left the cache but hasn't mapped it yet, or
+ * a fork copying it into a child we've already been past. They keep
+ * it until they let go as usual.
+ */
+static
+paddr_t
+vm_reclaim_text(paddr_t want)
+{
+	struct addrspace *ases[VM_RECLAIM_BATCH], *as;
+	uint32_t *ptes[VM_RECLAIM_BATCH], *pte;
+	paddr_t paddr;
+	vaddr_t vaddr;
+	unsigned i, n;
+
+	paddr = textcache_reclaim(want, &vaddr);
+	if (paddr == 0) {
+		return 0;
+	}
+
+	do {
+		n = 0;
+		spinlock_acquire(&vm_aslist_lock);
+		for (as = vm_aslist; as != NULL && n < VM_RECLAIM_BATCH; as = as->as_next) {
+			spinlock_acquire(&as->as_lock);
+			pte = as_pte_lookup(as, vaddr);
+			if (pte != NULL && (*pte & PTE_FRAME) == paddr &&
+			    (*pte & (PTE_RESIDENT | PTE_BUSY | PTE_CACHED)) ==
+			    (PTE_RESIDENT | PTE_CACHED)) {
+				*pte = (*pte | PTE_BUSY) & ~TLBLO_VALID;
+				ases[n] = as;
+				ptes[n] = pte;
+				n++;
+			}
+			spinlock_release(&as->as_lock);
+		}
+		spinlock_release(&vm_aslist_lock);
+
+		for (i = 0; i < n; i++) {
+			vm_shootdown(ases[i], &vaddr, 1);
+			spinlock_acquire(&ases[i]->as_lock);
+			*ptes[i] = 0;
+			wchan_wakeall(vm_wchan);
+			spinlock_release(&ases[i]->as_lock);
+			//that mapper's reference; ours keeps the frame from going anywhere
+			coremap_free(paddr);
+		}
+	} while (n == VM_RECLAIM_BATCH);
+
+	if (coremap_refcount(paddr) == 1) {
+		return paddr;
+	}
+	coremap_free(paddr);
+	return 0;
+}
+
+bool
+vm_reclaim(paddr_t paddr)
+{
+	return vm_reclaim_text(paddr) != 0;
+}
+
+/*
+ * Push some user page out to swap and hand its frame to the caller.
+ * Clean copies of file pages are dropped instead, setting *CLEAN. If
+ * the clock finds nothing, a frame is taken back from the text cache,
+ * which counts as clean too: it comes back from the file as cheaply,
+ * but everyone running the program shares it, so it goes last.
+ * Returns 0 if there is nothing we can evict or nowhere to put it.
+ */
+static
+paddr_t
+vm_evict(bool *clean)
+{
+	struct addrspace *as;
+	uint32_t *pte;
+	vaddr_t vaddr;
+	paddr_t paddr = 0;
+	unsigned tries, spared, total, nfree;
+	bool referenced;
+
+	coremap_stats(&total, &nfree);
+
+	lock_acquire(evict_lock);
+	tries = spared = 0;
+	while (tries < VM_EVICT_TRIES) {
+		//the victim is pinned, so its owner can't finish as_destroy until we let go
+		paddr = coremap_pick_victim(&as, &vaddr, &referenced);
+		if (paddr == 0) {
+			break;
+		}
+
+		pte = vm_victim_pte(as, vaddr, paddr);
+		if (pte == NULL) {
+			coremap_unpin(paddr, false);
+			paddr = 0;
+			tries++;
+			continue;
+		}
+		//over its allowance, it gets no second chances
+		if (referenced && spared < 2 * total &&
+		    as->as_wset.ws_resident <= as->as_wset.ws_allow) {
+			/*
+			 * Used since the clock last came by, so it gets another
+			 * lap. Refills done by the UTLB handler don't tell the
+			 * coremap anything, so make the next miss come to
+			 * vm_fault, which does.
+			 */
+			*pte &= ~TLBLO_VALID;
+			spinlock_release(&as->as_lock);
+			coremap_unpin(paddr, false);
+			paddr = 0;
+			spared++;
+			continue;
+		}
+		paddr = vm_evict_page(as, pte, vaddr, paddr, clean);
+		break;
+	}
+	lock_release(evict_lock);
+
+	for (tries = 0; paddr == 0 && tries < VM_EVICT_TRIES; tries++) {
+		paddr = vm_reclaim_text(0);
+		if (paddr != 0) {
+			*clean = true;
+			vmstats_inc(VMSTAT_PAGEOUT_CLEAN);
+		}
+	}
+	return paddr;
+}
+
+/*
+ * Take write access to the page at VADDR in AS away everywhere, if it
+ * is still in frame PADDR (which the caller has pinned), and mark it
+ * busy. Hands back the entry as it was in OLD. Returns NULL if the page
+ * has moved on, or is busy with something else.
+ */
+static
+uint32_t *
+vm_freeze_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr, uint32_t *old)
+{
+	uint32_t *pte = as_pte_lookup(as, vaddr);
+
+	if (pte == NULL) {
+		return NULL;
+	}
+	spinlock_acquire(&as->as_lock);
+	if ((*pte & (PTE_RESIDENT | PTE_BUSY | PTE_COW)) != PTE_RESIDENT ||
+	    (*pte & PTE_FRAME) != paddr) {
+		spinlock_release(&as->as_lock);
+		return NULL;
+	}
+	*old = *pte;
+	*pte = (*pte | PTE_BUSY) & ~(TLBLO_VALID | TLBLO_DIRTY);
+	spinlock_release(&as->as_lock);
+
+	vm_shootdown(as, &vaddr, 1);
+	return pte;
+}
+
+bool
+vm_ksm_share(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	uint32_t *pte, old;
+
+	pte = vm_freeze_page(as, vaddr, paddr, &old);
+	if (pte == NULL) {
+		return false;
+	}
+	//the scanner's reference; from here on a write gets a copy
+	coremap_incref(paddr);
+
+	spinlock_acquire(&as->as_lock);
+	*pte = (*pte & ~PTE_BUSY) | PTE_COW | (old & TLBLO_VALID);
+	wchan_wakeall(vm_wchan);
+	spinlock_release(&as->as_lock);
+	return true;
+}
+
+bool
+vm_ksm_merge(struct addrspace *as, vaddr_t vaddr, paddr_t from, paddr_t into)
+{
+	uint32_t *pte, old;
+	bool same;
+
+	pte = vm_freeze_page(as, vaddr, from, &old);
+	if (pte == NULL) {
+		return false;
+	}
+	//nothing can write FROM now, and INTO is copy-on-write everywhere
+	same = memcmp((const void *)PADDR_TO_KVADDR(from),
+		      (const void *)PADDR_TO_KVADDR(into), PAGE_SIZE) == 0;
+	if (same) {
+		coremap_incref(into);
+	}
+
+	spinlock_acquire(&as->as_lock);
+	if (same) {
+		*pte = (*pte & ~(PTE_FRAME | PTE_BUSY)) | into | PTE_COW | (old & TLBLO_VALID);
+	}
+	else {
+		*pte = (*pte & ~PTE_BUSY) | (old & (TLBLO_VALID | TLBLO_DIRTY));
+	}
+	wchan_wakeall(vm_wchan);
+	spinlock_release(&as->as_lock);
+	return same;
+}
+
+bool
+vm_migrate(struct addrspace *as, vaddr_t vaddr, paddr_t from, paddr_t to)
+{
+	uint32_t *pte, old;
+
+	pte = vm_freeze_page(as, vaddr, from, &old);
+	if (pte == NULL) {
+		return false;
+	}
+	memcpy((void *)PADDR_TO_KVADDR(to), (const void *)PADDR_TO_KVADDR(from), PAGE_SIZE);
+
+	spinlock_acquire(&as->as_lock);
+	*pte = (*pte & ~(PTE_FRAME | PTE_BUSY)) | to | (old & (TLBLO_VALID | TLBLO_DIRTY));
+	coremap_set_owner(to, as, vaddr);
+	wchan_wakeall(vm_wchan);
+	spinlock_release(&as->as_lock);
+	return true;
+}
+
+bool
+vm_pageout(bool *clean)
+{
+	paddr_t paddr;
+
+	paddr = vm_evict(clean);
+	if (paddr == 0) {
+		return false;
+	}
+	coremap_free(paddr);
+	return true;
+}
+
+/*
+ * Frames as_wset_sample picks for vm_wset_sweep to page out, and whose
+ * they are. Only the sweep thread uses them.
+ */
+static paddr_t wset_victims[WSET_SWEEPMAX];
+static vaddr_t wset_victimaddrs[WSET_SWEEPMAX];
+static struct addrspace *wset_victimas[WSET_SWEEPMAX];
+
+/*
+ * Sample the next leaf of AS's page table, from ws_cursor on: count the
+ * frames AS has to itself and how many it has used since the last
+ * sweep, and clear their reference bits and TLBLO_VALID so the next
+ * use comes to vm_fault and sets the bit again. Unused frames go into
+ * VICTIMS and their addresses into ADDRS, up to MAX of them, counting
+ * in *FOUND. Returns
+ * true once the whole table has been sampled. One leaf at a time keeps
+ * how long interrupts are off bounded by the size of a leaf, not of
+ * the address space. Called with the owning process's p_lock held,
+ * which keeps AS from being destroyed.
+ */
+static
+bool
+as_wset_sample(struct addrspace *as, paddr_t *victims, vaddr_t *addrs,
+	       unsigned max, unsigned *found)
+{
+	struct wset *ws = &as->as_wset;
+	uint32_t *leaf;
+	paddr_t paddr;
+	unsigned d, i;
+	bool done;
+
+	spinlock_acquire(&as->as_lock);
+	for (d = ws->ws_cursor; d < PT_DIRENTRIES; d++) {
+		if (as->as_pagedir[d] != NULL) {
+			break;
+		}
+	}
+	if (d < PT_DIRENTRIES) {
+		leaf = as->as_pagedir[d];
+		for (i = 0; i < PT_LEAFENTRIES; i++) {
+			if ((leaf[i] & (PTE_RESIDENT | PTE_BUSY | PTE_COW | PTE_CACHED)) !=
+			    PTE_RESIDENT) {
+				continue;
+			}
+			ws->ws_sampled++;
+			paddr = leaf[i] & PTE_FRAME;
+			leaf[i] &= ~TLBLO_VALID;
+			if (coremap_sample_ref(paddr)) {
+				ws->ws_used++;
+			}
+			else if (*found < max) {
+				victims[*found] = paddr;
+				addrs[*found] = (d << PT_DIRSHIFT) | (i << PT_LEAFSHIFT);
+				(*found)++;
+			}
+		}
+		d++;
+	}
+	ws->ws_cursor = d;
+	done = d == PT_DIRENTRIES;
+	spinlock_release(&as->as_lock);
+	return done;
+}
+
+/*
+ * Once as_wset_sample has been through all of AS, let wset_adjust have
+ * its say, and start the next sweep from the top. If AS ends up over
+ * its allowance, pin up to that many of the FOUND frames in VICTIMS
+ * that are still its own and unused, move them and their ADDRS to the
+ * front, and return how many. Called with the owning process's p_lock
+ * held.
+ */
+static
+unsigned
+as_wset_trim(struct addrspace *as, paddr_t *victims, vaddr_t *addrs,
+	     unsigned found)
+{
+	struct wset *ws = &as->as_wset;
+	struct addrspace *owner;
+	vaddr_t vaddr;
+	unsigned i, n, excess;
+
+	spinlock_acquire(&as->as_lock);
+	excess = wset_adjust(ws, ws->ws_sampled, ws->ws_used);
+	ws->ws_cursor = 0;
+	ws->ws_sampled = ws->ws_used = 0;
+
+	n = 0;
+	for (i = 0; i < found && n < excess; i++) {
+		if (!coremap_pin(victims[i], &owner, &vaddr)) {
+			continue;
+		}
+		if (owner != as || vaddr != addrs[i]) {
+			coremap_unpin(victims[i], false);
+			continue;
+		}
+		victims[n] = victims[i];
+		addrs[n] = vaddr;
+		n++;
+	}
+	spinlock_release(&as->as_lock);
+	return n;
+}
+
+void
+vm_wset_sweep(void)
+{
+	struct addrspace *as;
+	struct proc *p;
+	uint32_t *pte;
+	paddr_t paddr;
+	unsigned i, j, n, num, found, room, total;
+	bool clean, done;
+
+	total = 0;
+	lock_acquire(process_list_lock);
+	num = array_num(process_list);
+	for (i = 0; i < num; i++) {
+		p = array_get(process_list, i);
+		room = WSET_SWEEPMAX - total;
+		if (room > WSET_TRIMMAX) {
+			room = WSET_TRIMMAX;
+		}
+		/*
+		 * A leaf per p_lock hold. If the address space changes
+		 * between leaves (execv), the new one is sampled from its
+		 * own cursor, and as_wset_trim only pins victims that are
+		 * still its own.
+		 */
+		found = n = 0;
+		do {
+			spinlock_acquire(&p->p_lock);
+			as = p->p_addrspace;
+			done = as == NULL ||
+				as_wset_sample(as, &wset_victims[total],
+					       &wset_victimaddrs[total], room, &found);
+			if (as != NULL && done) {
+				n = as_wset_trim(as, &wset_victims[total],
+						 &wset_victimaddrs[total], found);
+			}
+			spinlock_release(&p->p_lock);
+		} while (!done);
+		for (j = 0; j < n; j++) {
+			wset_victimas[total++] = as;
+		}
+	}
+	lock_release(process_list_lock);
+
+	//the pinned frames keep their address spaces around until the last is let go
+	lock_acquire(evict_lock);
+	for (j = 0; j < total; j++) {
+		as = wset_victimas[j];
+		pte = vm_victim_pte(as, wset_victimaddrs[j], wset_victims[j]);
+		if (pte == NULL) {
+			coremap_unpin(wset_victims[j], false);
+			continue;
+		}
+		paddr = vm_evict_page(as, pte, wset_victimaddrs[j], wset_victims[j], &clean);
+		if (paddr == 0) {
+			//no room in swap, so leave the rest where they are
+			for (j++; j < total; j++) {
+				coremap_unpin(wset_victims[j], false);
+			}
+			break;
+		}
+		coremap_free(paddr);
+		vmstats_inc(VMSTAT_WSET_TRIM);
+	}
+	lock_release(evict_lock);
+}
+
+/*
+ * Get a frame for a user page, evicting somebody else's if we must.
+ */
+static
+paddr_t
+vm_getuserpage(void)
+{
+	paddr_t paddr;
+	bool clean;
+
+	paddr = coremap_alloc(1);
+	pageout_check();
+	if (paddr == 0) {
+		//a zeroed frame is as good as any other
+		paddr = zeropool_get();
+	}
+	if (paddr == 0) {
+		//the page-out daemon didn't keep up
+		paddr = vm_evict(&clean);
+		if (paddr != 0) {
+			vmstats_inc(VMSTAT_PAGEOUT_DIRECT);
+		}
+	}
+	if (paddr == 0) {
+		DEBUG(DB_VM, "dumbvm: out of memory and swap allocating a user page\n");
+		if (dbflags & DB_VM) {
+			coremap_dump();
+		}
+	}
+	return paddr;
+}
+#endif //OPT_A3
+
+static
+void
+as_zero_region(paddr_t paddr, unsigned npages)
+{
+	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+}
+
+#if OPT_A3
+/*
+ * Get a zero-filled frame, from the pool if the idle loop has left us
+ * one and by zeroing it here if not.
+ */
+static
+paddr_t
+vm_getzeroedpage(void)
+{
+	paddr_t paddr;
+
+	paddr = zeropool_get();
+	if (paddr != 0) {
+		vmstats_inc(VMSTAT_ZERO_POOL_HIT);
+		return paddr;
+	}
+	vmstats_inc(VMSTAT_ZERO_POOL_MISS);
+
+	paddr = vm_getuserpage();
+	if (paddr != 0) {
+		as_zero_region(paddr, 1);
+	}
+	return paddr;
+}
+
+/*
+ * Find the page table entry for VADDR in AS, adding a leaf to the
+ * table if need be. Called without the address space lock, since
+ * getting a leaf may mean evicting a page.
+ */
+static
+int
+as_pte_create(struct addrspace *as, vaddr_t vaddr, uint32_t **ret)
+{
+	uint32_t **slot = &as->as_pagedir[PT_DIRINDEX(vaddr)];
+	paddr_t leaf;
+
+	if (*slot == NULL) {
+		//leaves are page sized, and can come out of user memory like any other page
+		leaf = vm_getzeroedpage();
+		if (leaf == 0) {
+			return ENOMEM;
+		}
+
+		spinlock_acquire(&as->as_lock);
+		if (*slot == NULL) {
+			*slot = (uint32_t *)PADDR_TO_KVADDR(leaf);
+			leaf = 0;
+		}
+		spinlock_release(&as->as_lock);
+
+		freeppages(leaf);
+	}
+	*ret = &(*slot)[PT_LEAFINDEX(vaddr)];
+	return 0;
+}
+#endif //OPT_A3
+
+#if OPT_A3
+/*
+ * Give a copy-on-write page a frame of its own. If everyone else has
+ * already let go of the shared frame we can just keep it. Called and
+ * returns with the address space lock held; the old frame's reference,
+ * if any, is handed back in OLDFRAME to be dropped once that lock is
+ * released.
+ */
+static
+int
+as_break_cow(struct addrspace *as, uint32_t *pte, vaddr_t vaddr,
+	     paddr_t *oldframe)
+{
+	paddr_t old, new;
+
+	KASSERT(*pte & PTE_COW);
+
+	*oldframe = 0;
+	old = *pte & PTE_FRAME;
+	if (old != vm_zeroframe && coremap_refcount(old) == 1) {
+		*pte &= ~PTE_COW;
+		coremap_set_owner(old, as, vaddr);
+		return 0;
+	}
+
+	*pte = (*pte | PTE_BUSY) & ~TLBLO_VALID;
+	spinlock_release(&as->as_lock);
+
+	//nobody can free or evict a shared frame while we hold our reference to it
+	if (old == vm_zeroframe) {
+		new = vm_getzeroedpage();
+	}
+	else {
+		new = vm_getuserpage();
+		if (new != 0) {
+			memmove((void *)PADDR_TO_KVADDR(new),
+				(const void *)PADDR_TO_KVADDR(old), PAGE_SIZE);
+		}
+	}
+
+	spinlock_acquire(&as->as_lock);
+	*pte &= ~PTE_BUSY;
+	wchan_wakeall(vm_wchan);
+	if (new == 0) {
+		return ENOMEM;
+	}
+	*pte = (*pte & ~(PTE_FRAME | PTE_COW)) | new;
+	coremap_set_owner(new, as, vaddr);
+	*oldframe = old == vm_zeroframe ? 0 : old;
+	as->as_vmstat.vs_cowbreaks++;
+	as->as_wset.ws_faults++;
+
+	//other cpus may still have read-only entries for the old frame
+	as_asid_retire_others(as);
+	return 0;
+}
+#endif //OPT_A3
+
+#if OPT_A3
+/*
+ * Fill the part of the page at PAGE (backed by frame PADDR, already
+ * zeroed) that comes from the executable, going through every region
+ * that covers it. Sets FROMFILE if anything was actually read; pages
+ * that are all bss are left alone.
+ */
+static
+int
+as_load_page(struct addrspace *as, vaddr_t page, paddr_t paddr,
+	     bool *fromfile)
+{
+	struct segmentBacking *backing;
+	struct region *r;
+	struct iovec iov;
+	struct uio u;
+	vaddr_t start, end;
+	int result;
+
+	*fromfile = false;
+	for (r = as->as_regions; r != NULL && r->rg_vbase <= page; r = r->rg_next) {
+		backing = &r->rg_backing;
+		if (page - r->rg_vbase >= r->rg_npages * PAGE_SIZE ||
+		    backing->vnode == NULL) {
+			continue;
+		}
+
+		start = page > backing->vaddr ? page : backing->vaddr;
+		end = backing->vaddr + backing->filesize;
+		if (end > page + PAGE_SIZE) {
+			end = page + PAGE_SIZE;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		uio_kinit(&iov, &u, (void *)(PADDR_TO_KVADDR(paddr) + (start - page)),
+			  end - start, backing->offset + (start - backing->vaddr),
+			  UIO_READ);
+		result = VOP_READ(backing->vnode, &u);
+		if (result) {
+			return result;
+		}
+		if (u.uio_resid != 0) {
+			kprintf("ELF: short read on segment - file truncated?\n");
+			return ENOEXEC;
+		}
+		*fromfile = true;
+	}
+	return 0;
+}
+
+/*
+ * Whether the page at PAGE is all zero-fill: no region covering it has
+ * any of a file in it.
+ */
+static
+bool
+as_page_zerofill(struct addrspace *as, vaddr_t page)
+{
+	struct segmentBacking *backing;
+	struct region *r;
+
+	for (r = as->as_regions; r != NULL && r->rg_vbase <= page; r = r->rg_next) {
+		backing = &r->rg_backing;
+		if (page - r->rg_vbase >= r->rg_npages * PAGE_SIZE ||
+		    backing->vnode == NULL) {
+			continue;
+		}
+		if (backing->vaddr < page + PAGE_SIZE &&
+		    backing->vaddr + backing->filesize > page) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Bring in the page at VADDR: from swap if it was paged out, otherwise
+ * zero-filled and loaded from the executable. READONLY text pages are
+ * shared through the text cache. PAGESTAT is set to the vmstats
+ * counter describing where it came from. Called and returns with the
+ * address space lock held.
+ */
+static
+int
+as_page_in(struct addrspace *as, uint32_t *pte, vaddr_t vaddr,
+	   bool readonly, unsigned *pagestat)
+{
+	bool swapped = (*pte & PTE_SWAPPED) != 0;
+	unsigned slot = *pte >> PTE_SLOTSHIFT;
+	uint32_t modified = *pte & PTE_MODIFIED;
+	struct vnode *text = NULL;
+	struct region *r;
+	bool fromfile = false, cached = false;
+	paddr_t paddr, shared;
+	int result;
+
+	KASSERT((*pte & PTE_RESIDENT) == 0);
+
+	//the cache goes by virtual address, which only means something for the executable
+	r = as_find_region(as, vaddr);
+	if (readonly && !swapped && r->rg_mapflags == 0) {
+		text = r->rg_backing.vnode;
+	}
+
+	*pte |= PTE_BUSY;
+	spinlock_release(&as->as_lock);
+
+	if (text != NULL) {
+		//somebody else running this program may already have it
+		paddr = textcache_lookup(text, vaddr);
+		if (paddr != 0) {
+			cached = true;
+			goto done;
+		}
+	}
+
+	//no point zeroing what swap_in is about to overwrite
+	paddr = swapped ? vm_getuserpage() : vm_getzeroedpage();
+	if (paddr == 0) {
+		result = ENOMEM;
+	}
+	else if (swapped) {
+		result = swap_in(slot, paddr);
+		*pagestat = VMSTAT_PAGE_FAULT_DISK;
+	}
+	else {
+		result = as_load_page(as, vaddr, paddr, &fromfile);
+		if (fromfile) {
+			vmstats_inc(VMSTAT_ELF_FILE_READ);
+			*pagestat = VMSTAT_PAGE_FAULT_DISK;
+		}
+		else {
+			*pagestat = VMSTAT_PAGE_FAULT_ZERO;
+		}
+	}
+	if (result && paddr != 0) {
+		freeppages(paddr);
+	}
+	if (result == 0 && text != NULL) {
+		shared = textcache_insert(text, vaddr, paddr);
+		if (shared != 0) {
+			paddr = shared;
+			cached = true;
+		}
+	}
+
+ done:
+	spinlock_acquire(&as->as_lock);
+	if (result == 0) {
+		*pte = paddr | PTE_RESIDENT | (cached ? PTE_CACHED : 0) | modified |
+			(fromfile ? PTE_CLEAN : 0);
+		as->as_wset.ws_faults++;
+		if (swapped) {
+			swap_free(slot);
+			as->as_vmstat.vs_swapfaults++;
+		}
+		else if (fromfile || cached) {
+			as->as_vmstat.vs_filefaults++;
+		}
+		else {
+			as->as_vmstat.vs_zerofaults++;
+		}
+		if (!cached) {
+			//it's in the page table now, so an eviction that finds it will make sense of it
+			coremap_set_owner(paddr, as, vaddr);
+		}
+	}
+	else {
+		*pte &= ~PTE_BUSY;
+	}
+	wchan_wakeall(vm_wchan);
+	return result;
+}
+#endif //OPT_A3
+
+#if OPT_A3
+/*
+ * Extend the stack region down to cover VADDR, if that's within
+ * DUMBVM_STACKLIMIT of the top and doesn't run into the region below.
+ * Only the region grows; pages are still zero-filled as they're
+ * touched. Returns false if VADDR is no place for the stack.
+ */
+static
+bool
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *r = as->as_stack;
+	struct region *below;
+	vaddr_t base = vaddr & PAGE_FRAME;
+
+	if (r == NULL || base >= r->rg_vbase ||
+	    base < USERSTACK - DUMBVM_STACKLIMIT * PAGE_SIZE) {
+		return false;
+	}
+	for (below = as->as_regions; below != NULL && below->rg_next != r; below = below->rg_next) {
+		/* nothing */
+	}
+	if (below != NULL && below->rg_vbase + below->rg_npages * PAGE_SIZE > base) {
+		return false;
+	}
+
+	r->rg_npages += (r->rg_vbase - base) / PAGE_SIZE;
+	r->rg_vbase = base;
+	return true;
+}
+
+/*
+ * Fault-around: after a TLB miss at FAULTADDRESS, also load TLB entries
+ * for the resident pages that follow it in the same region, so a
+ * sequential scan doesn't take a miss on every page. Only pages the
+ * UTLB handler could load anyway (TLBLO_VALID set) are done, so this
+ * doesn't get around the clock's reference tracking.
+ *
+ * The window adapts to the access pattern: if this fault is at the
+ * page right after the last window, the scan walked through it and the
+ * window doubles; if not, it halves. The TLB can't tell us whether a
+ * prefetched entry was ever used, so the counters only say which way
+ * each window went: entries in a window the next fault carried on
+ * from are "followed", the rest "abandoned".
+ *
+ * Called with the address space lock held, after the faulting page's
+ * entry has been written.
+ */
+static
+void
+as_fault_around(struct addrspace *as, vaddr_t faultaddress, uint32_t asid)
+{
+	struct region *r;
+	vaddr_t vaddr, top;
+	uint32_t *pte, ehi;
+	unsigned n;
+
+	KASSERT(spinlock_do_i_hold(&as->as_lock));
+
+	if (faultaddress == as->as_fa_next) {
+		vmstats_add(VMSTAT_FAULTAROUND_FOLLOWED, as->as_fa_pending);
+		as->as_fa_window = as->as_fa_window == 0 ? 1 : as->as_fa_window * 2;
+		if (as->as_fa_window > VM_FAULTAROUND_MAX) {
+			as->as_fa_window = VM_FAULTAROUND_MAX;
+		}
+	}
+	else {
+		vmstats_add(VMSTAT_FAULTAROUND_ABANDONED, as->as_fa_pending);
+		as->as_fa_window /= 2;
+	}
+
+	r = as_find_region(as, faultaddress);
+	top = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+	vaddr = faultaddress + PAGE_SIZE;
+	for (n = 0; n < as->as_fa_window && vaddr < top; n++, vaddr += PAGE_SIZE) {
+		pte = as_pte_lookup(as, vaddr);
+		if (pte == NULL || (*pte & (TLBLO_VALID | PTE_BUSY)) != TLBLO_VALID) {
+			break;
+		}
+		ehi = vaddr | (asid << TLBHI_PIDSHIFT);
+		if (tlb_probe(ehi, 0) >= 0) {
+			//already there, and a duplicate would be fatal
+			continue;
+		}
+		//not referenced yet, so the first to go if the scan stops here
+		tlb_shadow_write(ehi, *pte & ~PTE_SWBITS, false);
+	}
+	as->as_fa_pending = n;
+	as->as_fa_next = vaddr;
+}
+
+/*
+ * Read the cpu's cycle counter (CP0 Count), which sys161 runs at the
+ * processor clock rate.
+ */
+static
+inline
+uint32_t
+vm_cycles(void)
+{
+	uint32_t count;
+
+	__asm volatile(".set push;"
+		       ".set mips32;"
+		       "mfc0 %0, $9;"
+		       ".set pop"
+		       : "=r" (count));
+	return count;
+}
+
+/*
+ * Which vs_faulthist bucket a fault that took CYCLES falls in: the
+ * floor of its log base 2.
+ */
+static
+unsigned
+vm_histbucket(uint32_t cycles)
+{
+	unsigned bucket = 0;
+
+	while (cycles > 1 && bucket < VS_HISTBUCKETS - 1) {
+		cycles >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+#endif //OPT_A3
+
+#if OPT_A3
+static
+int
+vm_fault_service(int faulttype, vaddr_t faultaddress)
+#else
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+#endif
+{
+	paddr_t paddr;
+	int i;
+	uint32_t ehi, elo;
+	struct addrspace *as;
+	#if OPT_A3
+	int result;
+	uint32_t *pte;
+	bool readonly;
+	unsigned pagestat = VMSTAT_TLB_RELOAD;
+	bool tracked;
+	paddr_t oldframe = 0;
+	uint32_t asid;
+	#endif
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		//write to a copy-on-write page (or to the code segment), sorted out below
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	#if OPT_A3
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+	if (as_find_region(as, faultaddress) == NULL && !as_grow_stack(as, faultaddress)) {
+		return EFAULT;
+	}
+	//text is only read-only once loadelf is done with it
+	readonly = as->loadelfcompleted && !as_page_writeable(as, faultaddress);
+	tracked = as_region_writesback(as_find_region(as, faultaddress));
+	if (faulttype == VM_FAULT_READONLY && readonly) {
+		return EFAULT;
+	}
+
+	result = as_pte_create(as, faultaddress, &pte);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Hold the address space lock from here until the TLB entry is
+	 * written, so the page can't be evicted out from under us. (The
+	 * lock also keeps interrupts off while we frob the TLB.)
+	 */
+	spinlock_acquire(&as->as_lock);
+	as_wait_pte(as, pte);
+	if (faulttype != VM_FAULT_READONLY) {
+		as->as_vmstat.vs_tlbmisses++;
+	}
+
+	if (*pte == 0 && faulttype == VM_FAULT_READ && as_page_zerofill(as, faultaddress)) {
+		//being read before it's ever been written: zeros will do until then
+		*pte = vm_zeroframe | PTE_RESIDENT | PTE_COW;
+		pagestat = VMSTAT_PAGE_FAULT_ZERO;
+		vmstats_inc(VMSTAT_ZERO_PAGE_HIT);
+		as->as_vmstat.vs_zerofaults++;
+	}
+	else if ((*pte & PTE_RESIDENT) == 0) {
+		//first touch, or paged out since: bring it in
+		result = as_page_in(as, pte, faultaddress, readonly, &pagestat);
+		if (result) {
+			spinlock_release(&as->as_lock);
+			return result;
+		}
+	}
+	else if (faulttype != VM_FAULT_READ && (*pte & PTE_COW) && !readonly) {
+		//first write since fork
+		result = as_break_cow(as, pte, faultaddress, &oldframe);
+		if (result) {
+			spinlock_release(&as->as_lock);
+			return result;
+		}
+	}
+	else {
+		coremap_touch(*pte & PTE_FRAME);
+		if ((*pte & PTE_COW) && (*pte & PTE_FRAME) != vm_zeroframe &&
+		    coremap_refcount(*pte & PTE_FRAME) == 1) {
+			//the other side has let go, so it's ours again (and evictable)
+			*pte &= ~PTE_COW;
+			coremap_set_owner(*pte & PTE_FRAME, as, faultaddress);
+		}
+	}
+	paddr = *pte & PTE_FRAME;
+
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	//we may have slept above, so don't assume the ASID as_activate set up is still current
+	asid = as_asid_assign(as);
+	tlb_setpid(asid);
+
+	ehi = faultaddress | (asid << TLBHI_PIDSHIFT);
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	if (tracked && faulttype != VM_FAULT_READ) {
+		*pte |= PTE_MODIFIED;
+	}
+	if (readonly || (*pte & PTE_COW) || (tracked && (*pte & PTE_MODIFIED) == 0)) {
+		//leave it read-only; for copy-on-write (or a clean shared page), the first write comes back as VM_FAULT_READONLY
+		elo &= ~TLBLO_DIRTY;
+	}
+	//next time this misses in the TLB, the UTLB handler can load it without us
+	*pte = elo | PTE_RESIDENT | (*pte & (PTE_COW | PTE_CACHED | PTE_MODIFIED)) |
+		(readonly ? PTE_READONLY : 0) |
+		((elo & TLBLO_DIRTY) ? 0 : *pte & PTE_CLEAN);
+
+	//the read-only mapping may still be in the TLB, if so upgrade it in place
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		tlbshadow[curcpu->c_number].ts_used |= TLBSHADOW_BIT(i);
+		tlbshadow[curcpu->c_number].ts_ref |= TLBSHADOW_BIT(i);
+		spinlock_release(&as->as_lock);
+		freeppages(oldframe);
+		return 0;
+	}
+
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	vmstats_inc(pagestat);
+
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	if (tlb_shadow_write(ehi, elo, true)) {
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+	}
+	else {
+		vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	}
+
+	as_fault_around(as, faultaddress, asid);
+	spinlock_release(&as->as_lock);
+	freeppages(oldframe);
+	return 0;
+	#endif //OPT_A3
+}
+
+#if OPT_A3
+/*
+ * Time each fault with the cycle counter and put it in the system and
+ * address space histograms. The counter is per-cpu, so a fault that
+ * slept and woke up on another cpu gets a rough time; faults that fail
+ * aren't counted, since most of those are about to kill the process.
+ */
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	uint32_t start;
+	unsigned bucket;
+	int result;
+
+	start = vm_cycles();
+	result = vm_fault_service(faulttype, faultaddress);
+	if (result) {
+		return result;
+	}
+	bucket = vm_histbucket(vm_cycles() - start);
+
+	spinlock_acquire(&vm_faulthist_lock);
+	vm_faulthist[bucket]++;
+	spinlock_release(&vm_faulthist_lock);
+
+	//vm_fault_service has already made sure there is one
+	as = curproc_getas();
+	spinlock_acquire(&as->as_lock);
+	as->as_vmstat.vs_faulthist[bucket]++;
+	spinlock_release(&as->as_lock);
+	return 0;
+}
+
+/*
+ * Copy out AS's statistics, counting its resident pages from the page
+ * table as it stands now.
+ */
+void
+as_getvmstat(struct addrspace *as, struct vmstat *vs)
+{
+	uint32_t *leaf;
+	unsigned d, i;
+
+	spinlock_acquire(&as->as_lock);
+	*vs = as->as_vmstat;
+	vs->vs_resident = 0;
+	vs->vs_wsestimate = as->as_wset.ws_estimate;
+	vs->vs_wsallow = as->as_wset.ws_allow;
+	for (d = 0; d < PT_DIRENTRIES; d++) {
+		leaf = as->as_pagedir[d];
+		if (leaf == NULL) {
+			continue;
+		}
+		for (i = 0; i < PT_LEAFENTRIES; i++) {
+			if (leaf[i] & PTE_RESIDENT) {
+				vs->vs_resident++;
+			}
+		}
+	}
+	spinlock_release(&as->as_lock);
+}
+
+/*
+ * Print every process's statistics, then the system-wide fault time
+ * histogram, for the menu.
+ */
+void
+vm_printstats(void)
+{
+	struct vmstat vs;
+	struct proc *p;
+	unsigned hist[VS_HISTBUCKETS];
+	unsigned i, num, total;
+	bool have;
+
+	kprintf("  pid name             resident     ws  allow   zero   file   swap  tlbmiss    cow\n");
+	lock_acquire(process_list_lock);
+	num = array_num(process_list);
+	for (i = 0; i < num; i++) {
+		p = array_get(process_list, i);
+		//holding p_lock keeps the address space from being destroyed under us
+		spinlock_acquire(&p->p_lock);
+		have = p->p_addrspace != NULL;
+		if (have) {
+			as_getvmstat(p->p_addrspace, &vs);
+		}
+		spinlock_release(&p->p_lock);
+		if (!have) {
+			continue;
+		}
+		kprintf("%5u %-16s %8u %6u %6u %6u %6u %6u %8u %6u\n", p->self_pid,
+			p->p_name, vs.vs_resident, vs.vs_wsestimate, vs.vs_wsallow,
+			vs.vs_zerofaults, vs.vs_filefaults, vs.vs_swapfaults,
+			vs.vs_tlbmisses, vs.vs_cowbreaks);
+	}
+	lock_release(process_list_lock);
+
+	spinlock_acquire(&vm_faulthist_lock);
+	memcpy(hist, vm_faulthist, sizeof(hist));
+	spinlock_release(&vm_faulthist_lock);
+
+	total = 0;
+	for (i = 0; i < VS_HISTBUCKETS; i++) {
+		total += hist[i];
+	}
+	kprintf("vm_fault service time, %u faults:\n", total);
+	for (i = 0; i < VS_HISTBUCKETS; i++) {
+		if (hist[i] != 0) {
+			kprintf("  %10u - %10u cycles: %u\n", (uint32_t)1 << i,
+				i == VS_HISTBUCKETS - 1 ? 0xffffffff : ((uint32_t)2 << i) - 1,
+				hist[i]);
+		}
+	}
+}
+#endif //OPT_A3
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as==NULL) {
+		return NULL;
+	}
+
+	#if OPT_A3
+	as->as_pagedir = kmalloc(PT_DIRENTRIES * sizeof(uint32_t *));
+	if (as->as_pagedir == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	bzero(as->as_pagedir, PT_DIRENTRIES * sizeof(uint32_t *));
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	as->as_heapbreak = 0;
+	as->as_stack = NULL;
+	as->loadelfcompleted = false;
+	as->as_fa_next = 0;
+	as->as_fa_window = 0;
+	as->as_fa_pending = 0;
+	spinlock_init(&as->as_lock);
+	bzero(as->as_asid, sizeof(as->as_asid));
+	bzero(&as->as_vmstat, sizeof(as->as_vmstat));
+	wset_init(&as->as_wset);
+	spinlock_acquire(&vm_aslist_lock);
+	as->as_next = vm_aslist;
+	vm_aslist = as;
+	spinlock_release(&vm_aslist_lock);
+	#else
+	as->as_vbase1 = 0;
+	//as->as_pbase1 = 0;
+	as->as_npages1 = 0;
+	as->as_vbase2 = 0;
+	//as->as_pbase2 = 0;
+	as->as_npages2 = 0;
+	//as->as_stackpbase = 0;
+	#endif
+	return as;
+}
+
+#if OPT_A3
+/*
+ * Hand back a batch of frames taken out of the page table by
+ * as_release_range. VNODES[i] is the executable if frame i is a shared
+ * text frame, NULL if it's the address space's own.
+ */
+static
+void
+as_release_frames(struct addrspace *as, paddr_t *frames, const vaddr_t *vaddrs,
+		  struct vnode *const *vnodes, unsigned n, bool shootdown)
+{
+	unsigned nown = 0;
+
+	if (shootdown && n > 0) {
+		//nobody may still be using a frame once it's back in the coremap
+		vm_shootdown(as, vaddrs, n);
+	}
+	for (unsigned i = 0; i < n; i++) {
+		if (vnodes[i] != NULL) {
+			textcache_release(vnodes[i], vaddrs[i], frames[i]);
+		}
+		else {
+			frames[nown++] = frames[i];
+		}
+	}
+	coremap_free_batch(frames, nown);
+}
+
+/*
+ * Empty the page table entries for [START, END): give back every frame
+ * and swap slot they refer to. Waits out any eviction in progress.
+ * Frames go back in batches with the address space lock dropped, since
+ * freeing may have to wait for an eviction to let go of a frame. If
+ * SHOOTDOWN, the address space may still be running somewhere, so each
+ * batch is shot out of every TLB before its frames are freed.
+ */
+static
+void
+as_release_range(struct addrspace *as, vaddr_t start, vaddr_t end, bool shootdown)
+{
+	paddr_t frames[32];
+	vaddr_t vaddrs[32];
+	struct vnode *vnodes[32];
+	unsigned n = 0;
+	uint32_t *pte;
+	vaddr_t vaddr;
+
+	spinlock_acquire(&as->as_lock);
+	for (vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+		pte = as_pte_lookup(as, vaddr);
+		if (pte == NULL) {
+			//no leaf, skip to the first page of the next one
+			vaddr |= (PT_LEAFENTRIES - 1) << PT_LEAFSHIFT;
+			continue;
+		}
+		as_wait_pte(as, pte);
+		if (*pte & PTE_SWAPPED) {
+			swap_free(*pte >> PTE_SLOTSHIFT);
+		}
+		else if ((*pte & PTE_RESIDENT) && (*pte & PTE_FRAME) != vm_zeroframe) {
+			frames[n] = *pte & PTE_FRAME;
+			vaddrs[n] = vaddr;
+			vnodes[n] = (*pte & PTE_CACHED) ?
+				as_find_region(as, vaddr)->rg_backing.vnode : NULL;
+			n++;
+		}
+		*pte = 0;
+
+		if (n == 32) {
+			spinlock_release(&as->as_lock);
+			as_release_frames(as, frames, vaddrs, vnodes, n, shootdown);
+			n = 0;
+			spinlock_acquire(&as->as_lock);
+		}
+	}
+	spinlock_release(&as->as_lock);
+
+	as_release_frames(as, frames, vaddrs, vnodes, n, shootdown);
+}
+
+/*
+ * Write the pages of shared file mapping R in [START, END) that have
+ * been modified since they last went to the file. Each page is kept
+ * busy while it's written, as for an eviction, and loses its write
+ * permission first (shot down if SHOOTDOWN, i.e. the address space may
+ * be running), so a write after this marks it again. Pages out in swap
+ * are read into a spare frame to be written. Only the part of the
+ * mapping that was inside the file is written; files don't grow.
+ */
+static
+int
+as_writeback(struct addrspace *as, struct region *r, vaddr_t start, vaddr_t end,
+	     bool shootdown)
+{
+	struct segmentBacking *backing = &r->rg_backing;
+	struct iovec iov;
+	struct uio u;
+	uint32_t *pte;
+	vaddr_t vaddr, fileend;
+	paddr_t paddr;
+	bool swapped;
+	size_t len;
+	int result = 0;
+
+	fileend = backing->vaddr + backing->filesize;
+	for (vaddr = start; vaddr < end && vaddr < fileend && result == 0; vaddr += PAGE_SIZE) {
+		pte = as_pte_lookup(as, vaddr);
+		if (pte == NULL) {
+			continue;
+		}
+		spinlock_acquire(&as->as_lock);
+		as_wait_pte(as, pte);
+		if ((*pte & PTE_MODIFIED) == 0) {
+			spinlock_release(&as->as_lock);
+			continue;
+		}
+		swapped = (*pte & PTE_SWAPPED) != 0;
+		*pte = (*pte | PTE_BUSY) & ~(PTE_MODIFIED | TLBLO_DIRTY);
+		spinlock_release(&as->as_lock);
+
+		if (swapped) {
+			paddr = vm_getuserpage();
+			result = paddr == 0 ? ENOMEM : swap_in(*pte >> PTE_SLOTSHIFT, paddr);
+		}
+		else {
+			paddr = *pte & PTE_FRAME;
+			if (shootdown) {
+				vm_shootdown(as, &vaddr, 1);
+			}
+		}
+		if (result == 0) {
+			len = fileend - vaddr < PAGE_SIZE ? fileend - vaddr : PAGE_SIZE;
+			uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(paddr), len,
+				  backing->offset + (vaddr - backing->vaddr), UIO_WRITE);
+			result = VOP_WRITE(backing->vnode, &u);
+		}
+		if (swapped && paddr != 0) {
+			freeppages(paddr);
+		}
 
-	as->as_vbase1 = 0;
-	//as->as_pbase1 = 0;
-	as->as_npages1 = 0;
-	as->as_vbase2 = 0;
-	//as->as_pbase2 = 0;
-	as->as_npages2 = 0;
-	//as->as_stackpbase = 0;
-	#if OPT_A3
-	as->loadelfcompleted = false;
-	as->as_pageTable1 = NULL;
-	as->as_pageTable2 = NULL;
-	as->as_pageTableStack = NULL;
-	#endif
-	return as;
+		spinlock_acquire(&as->as_lock);
+		if (result) {
+			//still isn't in the file
+			*pte |= PTE_MODIFIED;
+		}
+		else if (!swapped) {
+			*pte |= PTE_CLEAN;
+		}
+		*pte &= ~PTE_BUSY;
+		wchan_wakeall(vm_wchan);
+		spinlock_release(&as->as_lock);
+	}
+	return result;
 }
+#endif //OPT_A3
 
 void
 as_destroy(struct addrspace *as)
 {
 	#if OPT_A3
-	
-	for (int i = 0; i < (int)as->as_npages1; ++i) {
-		free_kpages(as->as_pageTable1[i].frameBasePhysAddr);
-	}
+	struct addrspace **pp;
+	struct region *r;
 
-	for (int i = 0; i < (int)as->as_npages2; ++i) {
-		free_kpages(as->as_pageTable2[i].frameBasePhysAddr);
+	//after this vm_reclaim_text can't find it; any entry it already has busy is waited out below
+	spinlock_acquire(&vm_aslist_lock);
+	for (pp = &vm_aslist; *pp != as; pp = &(*pp)->as_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = as->as_next;
+	spinlock_release(&vm_aslist_lock);
+
+	//shared mappings get written back on the way out, as if unmapped
+	for (r = as->as_regions; r != NULL; r = r->rg_next) {
+		if (as_region_writesback(r) &&
+		    as_writeback(as, r, r->rg_vbase, r->rg_vbase + r->rg_npages * PAGE_SIZE,
+				 false) != 0) {
+			kprintf("vm: lost changes to a shared mapping\n");
+		}
 	}
 
-	for (int i = 0; i < DUMBVM_STACKPAGES; ++i) {
-		free_kpages(as->as_pageTableStack[i].frameBasePhysAddr);
+	//ASIDs are never reused while anything is tagged with them, so no shootdown
+	as_release_range(as, 0, USERSPACETOP, false);
+
+	//don't leave any cpu's UTLB handler looking at the page table
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		if (cpupagetables[i] == (vaddr_t)as->as_pagedir) {
+			cpupagetables[i] = 0;
+		}
 	}
-	
-	
-	kfree(as->as_pageTable1);
-	kfree(as->as_pageTable2);
-	kfree(as->as_pageTableStack);
-	kfree(as);
+	for (unsigned d = 0; d < PT_DIRENTRIES; d++) {
+		if (as->as_pagedir[d] != NULL) {
+			free_kpages((vaddr_t)as->as_pagedir[d]);
+		}
+	}
+	kfree(as->as_pagedir);
 
-	spinlock_acquire(&stealmem_lock);
-	/*kprintf("Leak check begins\n");
-	for (int i = 0; i < noOfFrames; ++i) {
-		
-		if(coremap[i] != 0) {
-			kprintf("Leaked Memory at frame %d has value %d\n",i, coremap[i]);
+	while (as->as_regions != NULL) {
+		r = as->as_regions;
+		as->as_regions = r->rg_next;
+		if (r->rg_backing.vnode != NULL) {
+			VOP_DECREF(r->rg_backing.vnode);
 		}
-		
+		kfree(r);
 	}
-	kprintf("Leak check ends\n");
-	*/
-	spinlock_release(&stealmem_lock);
 
-	
+	spinlock_cleanup(&as->as_lock);
 	#endif
+	kfree(as);
 }
 
 void
 as_activate(void)
 {
-	int i, spl;
 	struct addrspace *as;
 
 	as = curproc_getas();
@@ -458,21 +2214,61 @@ as_activate(void)
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
+	#if OPT_A3
+	//entries are tagged with the ASID, so there's no need to flush anything
+	int spl = splhigh();
+	tlb_setpid(as_asid_assign(as));
+	cpupagetables[curcpu->c_number] = (vaddr_t)as->as_pagedir;
 	splx(spl);
+	#else
+	tlb_invalidate_all();
+	#endif
 }
 
 void
 as_deactivate(void)
 {
-	/* nothing */
+	#if OPT_A3
+	//the address space may be about to go away, stop refilling from it
+	int spl = splhigh();
+	cpupagetables[curcpu->c_number] = 0;
+	splx(spl);
+	#endif
+}
+
+#if OPT_A3
+/*
+ * Put a new region of NPAGES pages at VADDR into the list, in order.
+ * Returns NULL if out of memory.
+ */
+static
+struct region *
+as_add_region(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	      int readable, int writeable, int executable)
+{
+	struct region *r, **p;
+
+	r = kmalloc(sizeof(struct region));
+	if (r == NULL) {
+		return NULL;
+	}
+	r->rg_vbase = vaddr;
+	r->rg_npages = npages;
+	r->rg_readable = readable ? 1 : 0;
+	r->rg_writeable = writeable ? 1 : 0;
+	r->rg_executable = executable ? 1 : 0;
+	r->rg_mapflags = 0;
+	bzero(&r->rg_backing, sizeof(struct segmentBacking));
+
+	//keep the list sorted; page table entries only appear as pages get touched
+	for (p = &as->as_regions; *p != NULL && (*p)->rg_vbase <= vaddr; p = &(*p)->rg_next) {
+		/* nothing */
+	}
+	r->rg_next = *p;
+	*p = r;
+	return r;
 }
+#endif //OPT_A3
 
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
@@ -490,27 +2286,18 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	npages = sz / PAGE_SIZE;
 	
 	#if OPT_A3
-		if (readable) {
-			as->as_readable = 1;
-		}
-		else {
-			as->as_readable = 0;
-		}
-		if (writeable) {
-			as->as_writeable = 1;
-		}
-		else {
-			as->as_writeable = 0;
-		}
-		if (executable) {
-			as->as_executable = 1;
-		}
-		else {
-			as->as_executable = 0;
-		}
+	if (vaddr >= USERSPACETOP || npages > (USERSPACETOP - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+	if (as_add_region(as, vaddr, npages, readable, writeable, executable) == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+	#else
+	(void)readable;
+	(void)writeable;
+	(void)executable;
 
-	#endif
-	
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
@@ -528,89 +2315,431 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	 */
 	kprintf("dumbvm: Warning: too many regions\n");
 	return EUNIMP;
+	#endif
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
+int
+as_prepare_load(struct addrspace *as)
+{	
+	//the page table fills in lazily as vm_fault gets to each page
+	(void)as;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
 {
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+	#if OPT_A3
+	struct region *r;
+	vaddr_t top = 0;
+
+	//the heap starts out empty, on the first page past the program
+	for (r = as->as_regions; r != NULL; r = r->rg_next) {
+		if (r->rg_vbase + r->rg_npages * PAGE_SIZE > top) {
+			top = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+		}
+	}
+	if (top > USERSTACK - DUMBVM_STACKLIMIT * PAGE_SIZE) {
+		return ENOMEM;
+	}
+	as->as_heap = as_add_region(as, top, 0, 1, 1, 0);
+	if (as->as_heap == NULL) {
+		return ENOMEM;
+	}
+	as->as_heapbreak = top;
+	#else
+	(void)as;
+	#endif
+	return 0;
 }
 
 int
-as_prepare_load(struct addrspace *as)
-{	
-	//allocationg memory for the page table entries for the address space
-	as->as_pageTable1 = kmalloc(sizeof(struct pageTableEntry) * (int)as->as_npages1);
-	if(as->as_pageTable1 == NULL){
-        return ENOMEM;
-    }
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	#if OPT_A3
+	int result;
+
+	result = as_define_region(as, USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE,
+				  DUMBVM_STACKPAGES * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	//vm_fault grows it from here
+	as->as_stack = as_find_region(as, USERSTACK - PAGE_SIZE);
+	#else
+	//KASSERT(as->as_stackpbase != 0);
+	(void)as;
+	#endif
+	*stackptr = USERSTACK;
+	return 0;
+}
 
-	as->as_pageTable2 = kmalloc(sizeof(struct pageTableEntry) * (int)as->as_npages2);
-	if(as->as_pageTable2 == NULL){
-        return ENOMEM;
-    }
+#if OPT_A3
+int
+as_define_backing(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+		  off_t offset, size_t filesize)
+{
+	struct region *r;
 
-	as->as_pageTableStack = kmalloc(sizeof(struct pageTableEntry) * DUMBVM_STACKPAGES);
-	if(as->as_pageTableStack == NULL){
-        return ENOMEM;
-    }
+	//the region as_define_region made for this segment, which starts in the same page
+	for (r = as->as_regions; r != NULL; r = r->rg_next) {
+		if (r->rg_vbase == (vaddr & PAGE_FRAME) && r->rg_backing.vnode == NULL &&
+		    filesize <= r->rg_npages * PAGE_SIZE) {
+			break;
+		}
+	}
+	if (r == NULL) {
+		return EFAULT;
+	}
 
+	VOP_INCREF(v);
+	r->rg_backing.vnode = v;
+	r->rg_backing.offset = offset;
+	r->rg_backing.vaddr = vaddr;
+	r->rg_backing.filesize = filesize;
+	return 0;
+}
 
-	paddr_t pbase1, pbase2, pstackbase;
-	for (int i = 0; i < (int)as->as_npages1; ++i) {
-		pbase1 = getppages(1);
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *r = as->as_heap;
+	vaddr_t newbreak, oldtop, newtop, limit;
 
-		if (pbase1 == 0) {
-			return ENOMEM;
-		}		
+	if (r == NULL) {
+		return ENOMEM;
+	}
+	newbreak = as->as_heapbreak + amount;
+	if (amount < 0) {
+		if (newbreak > as->as_heapbreak || newbreak < r->rg_vbase) {
+			return EINVAL;
+		}
+	}
+	else if (newbreak < as->as_heapbreak) {
+		return ENOMEM;
+	}
 
-		as->as_pageTable1[i].frameBasePhysAddr = pbase1;
+	//room up to the next region, and never into the stack's reserve
+	limit = USERSTACK - DUMBVM_STACKLIMIT * PAGE_SIZE;
+	if (r->rg_next != NULL && r->rg_next->rg_vbase < limit) {
+		limit = r->rg_next->rg_vbase;
+	}
+	if (newbreak > limit) {
+		return ENOMEM;
+	}
 
-		as_zero_region(pbase1, 1);
-		
+	oldtop = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+	newtop = (newbreak + PAGE_SIZE - 1) & PAGE_FRAME;
+	r->rg_npages = (newtop - r->rg_vbase) / PAGE_SIZE;
+	if (newtop < oldtop) {
+		//the pages past the new break are gone for good
+		as_release_range(as, newtop, oldtop, true);
 	}
-	for (int i = 0; i < (int)as->as_npages2; ++i) {
-		pbase2 = getppages(1);
 
-		if (pbase2 == 0) {
-			return ENOMEM;
-		}		
+	*oldbreak = as->as_heapbreak;
+	as->as_heapbreak = newbreak;
+	return 0;
+}
 
-		as->as_pageTable2[i].frameBasePhysAddr = pbase2;
+int
+as_mmap(struct addrspace *as, vaddr_t addr, size_t len, int prot, int flags,
+	struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	struct region *r;
+	struct stat st;
+	vaddr_t base, gapstart, gapend, limit;
+	size_t npages;
+	int result;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0 ||
+	    ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+		return EINVAL;
+	}
+	if (v == NULL && (flags & MAP_SHARED)) {
+		//fork copies anonymous memory copy-on-write, so it couldn't stay shared
+		return EINVAL;
+	}
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
 
-		as_zero_region(pbase2, 1);
+	if (v != NULL) {
+		//the file system gets to say no (devices do)
+		result = VOP_MMAP(v);
+		if (result) {
+			return result;
+		}
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
 	}
-	for (int i = 0; i < (int)DUMBVM_STACKPAGES; ++i) {
-		pstackbase = getppages(1);
 
-		if (pstackbase == 0) {
+	if (flags & MAP_FIXED) {
+		base = addr;
+		if ((base & ~(vaddr_t)PAGE_FRAME) != 0 || base >= USERSPACETOP ||
+		    npages > (USERSPACETOP - base) / PAGE_SIZE) {
+			return EINVAL;
+		}
+		for (r = as->as_regions; r != NULL && r->rg_vbase < base + npages * PAGE_SIZE;
+		     r = r->rg_next) {
+			if (r->rg_vbase + r->rg_npages * PAGE_SIZE > base && r->rg_npages > 0) {
+				//we don't replace what's already there
+				return EINVAL;
+			}
+		}
+	}
+	else {
+		//the highest gap that fits, so the heap has as much room as it can
+		limit = USERSTACK - DUMBVM_STACKLIMIT * PAGE_SIZE;
+		gapstart = as->as_heap != NULL ?
+			as->as_heap->rg_vbase + as->as_heap->rg_npages * PAGE_SIZE : PAGE_SIZE;
+		base = 0;
+		for (r = as->as_regions; ; r = r->rg_next) {
+			gapend = (r == NULL || r->rg_vbase > limit) ? limit : r->rg_vbase;
+			if (gapend > gapstart && (gapend - gapstart) / PAGE_SIZE >= npages) {
+				base = gapend - npages * PAGE_SIZE;
+			}
+			if (r == NULL || r->rg_vbase >= limit) {
+				break;
+			}
+			if (r->rg_vbase + r->rg_npages * PAGE_SIZE > gapstart) {
+				gapstart = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+			}
+		}
+		if (base == 0) {
 			return ENOMEM;
-		}		
+		}
+	}
+
+	r = as_add_region(as, base, npages, prot & PROT_READ, prot & PROT_WRITE,
+			  prot & PROT_EXEC);
+	if (r == NULL) {
+		return ENOMEM;
+	}
+	r->rg_mapflags = flags & (MAP_SHARED | MAP_PRIVATE | MAP_ANON);
+	if (v != NULL) {
+		//pages come in from the file as they're touched, like the executable's
+		VOP_INCREF(v);
+		r->rg_backing.vnode = v;
+		r->rg_backing.offset = offset;
+		r->rg_backing.vaddr = base;
+		r->rg_backing.filesize = 0;
+		if (offset < st.st_size) {
+			r->rg_backing.filesize = st.st_size - offset < (off_t)(npages * PAGE_SIZE) ?
+				st.st_size - offset : npages * PAGE_SIZE;
+		}
+	}
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Check that [ADDR, ADDR+LEN) is a sane range for munmap or msync and
+ * hand back its page-aligned end.
+ */
+static
+int
+as_map_range(vaddr_t addr, size_t len, vaddr_t *end)
+{
+	if ((addr & ~(vaddr_t)PAGE_FRAME) != 0 || len == 0 ||
+	    addr >= USERSPACETOP || len > USERSPACETOP - addr) {
+		return EINVAL;
+	}
+	*end = (addr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region *r, *tail, **p;
+	vaddr_t end, rend, lo, hi;
+	int result;
+
+	result = as_map_range(addr, len, &end);
+	if (result) {
+		return result;
+	}
+
+	//only mappings can be unmapped, not the program, heap or stack
+	for (r = as->as_regions; r != NULL && r->rg_vbase < end; r = r->rg_next) {
+		if (r->rg_vbase + r->rg_npages * PAGE_SIZE > addr && r->rg_npages > 0 &&
+		    r->rg_mapflags == 0) {
+			return EINVAL;
+		}
+	}
+
+	p = &as->as_regions;
+	while ((r = *p) != NULL && r->rg_vbase < end) {
+		rend = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+		if (rend <= addr) {
+			p = &r->rg_next;
+			continue;
+		}
+		lo = addr > r->rg_vbase ? addr : r->rg_vbase;
+		hi = end < rend ? end : rend;
+
+		//a hole in the middle leaves the part above as a mapping of its own
+		tail = NULL;
+		if (lo > r->rg_vbase && hi < rend) {
+			tail = kmalloc(sizeof(struct region));
+			if (tail == NULL) {
+				return ENOMEM;
+			}
+		}
+
+		if (as_region_writesback(r)) {
+			result = as_writeback(as, r, lo, hi, true);
+			if (result) {
+				kfree(tail);
+				return result;
+			}
+		}
+		as_release_range(as, lo, hi, true);
+
+		if (lo == r->rg_vbase && hi == rend) {
+			*p = r->rg_next;
+			if (r->rg_backing.vnode != NULL) {
+				VOP_DECREF(r->rg_backing.vnode);
+			}
+			kfree(r);
+			continue;
+		}
+		if (tail != NULL) {
+			//the backing is by absolute address, so it carries over as is
+			*tail = *r;
+			tail->rg_vbase = hi;
+			tail->rg_npages = (rend - hi) / PAGE_SIZE;
+			if (tail->rg_backing.vnode != NULL) {
+				VOP_INCREF(tail->rg_backing.vnode);
+			}
+			r->rg_next = tail;
+			r->rg_npages = (lo - r->rg_vbase) / PAGE_SIZE;
+		}
+		else if (lo == r->rg_vbase) {
+			r->rg_vbase = hi;
+			r->rg_npages = (rend - hi) / PAGE_SIZE;
+		}
+		else {
+			r->rg_npages = (lo - r->rg_vbase) / PAGE_SIZE;
+		}
+		p = &r->rg_next;
+	}
+	return 0;
+}
 
-		as->as_pageTableStack[i].frameBasePhysAddr = pstackbase;
+int
+as_msync(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	struct region *r;
+	vaddr_t end, rend;
+	int result;
 
-		as_zero_region(pstackbase, 1);
+	result = as_map_range(addr, len, &end);
+	if (result) {
+		return result;
 	}
 
+	for (r = as->as_regions; r != NULL && r->rg_vbase < end; r = r->rg_next) {
+		rend = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+		if (rend <= addr || !as_region_writesback(r)) {
+			continue;
+		}
+		result = as_writeback(as, r, addr > r->rg_vbase ? addr : r->rg_vbase,
+				      end < rend ? end : rend, true);
+		if (result) {
+			return result;
+		}
+	}
 	return 0;
 }
+#endif //OPT_A3
 
+#if OPT_A3
+/*
+ * Give NEW a copy of OLD's region list, with its own references to the
+ * executable.
+ */
+static
 int
-as_complete_load(struct addrspace *as)
+as_copy_regions(struct addrspace *old, struct addrspace *new)
 {
-	(void)as;
+	struct region *r, *copy, **tail;
+
+	tail = &new->as_regions;
+	for (r = old->as_regions; r != NULL; r = r->rg_next) {
+		copy = kmalloc(sizeof(struct region));
+		if (copy == NULL) {
+			return ENOMEM;
+		}
+		*copy = *r;
+		copy->rg_next = NULL;
+		if (copy->rg_backing.vnode != NULL) {
+			VOP_INCREF(copy->rg_backing.vnode);
+		}
+		if (r == old->as_heap) {
+			new->as_heap = copy;
+		}
+		if (r == old->as_stack) {
+			new->as_stack = copy;
+		}
+		*tail = copy;
+		tail = &copy->rg_next;
+	}
 	return 0;
 }
 
+/*
+ * Share every page in leaf DIR of the old address space's page table
+ * with the new one: resident pages copy-on-write on both sides, pages
+ * out in swap by sharing the slot, which each side reads its own copy
+ * back from the first time it uses the page. Nothing is read or
+ * allocated here but the new leaf, so fork doesn't need memory for
+ * what's in swap, and doesn't count swap reads no fault asked for.
+ */
+static
 int
-as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+as_share_leaf(struct addrspace *old, struct addrspace *new, unsigned dir)
 {
-	//KASSERT(as->as_stackpbase != 0);
-	(void)as;
-	*stackptr = USERSTACK;
+	uint32_t *from = old->as_pagedir[dir];
+	uint32_t *to;
+	vaddr_t vbase = (vaddr_t)dir << PT_DIRSHIFT;
+	int result;
+
+	result = as_pte_create(new, vbase, &to);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&old->as_lock);
+	for (unsigned i = 0; i < PT_LEAFENTRIES; ++i) {
+		as_wait_pte(old, &from[i]);
+		if (from[i] & PTE_CACHED) {
+			//already shared, and never written
+			coremap_incref(from[i] & PTE_FRAME);
+			to[i] = from[i];
+			continue;
+		}
+		if (from[i] & PTE_RESIDENT) {
+			if ((from[i] & PTE_FRAME) != vm_zeroframe) {
+				coremap_incref(from[i] & PTE_FRAME);
+			}
+			//both sides can go on reading it without faulting, but not writing
+			from[i] = (from[i] | PTE_COW) & ~TLBLO_DIRTY;
+			to[i] = from[i];
+			continue;
+		}
+		if (from[i] & PTE_SWAPPED) {
+			swap_share(from[i] >> PTE_SLOTSHIFT);
+			to[i] = from[i];
+		}
+	}
+	spinlock_release(&old->as_lock);
 	return 0;
 }
+#endif //OPT_A3
 
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
@@ -622,36 +2751,40 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		return ENOMEM;
 	}
 
-	new->as_vbase1 = old->as_vbase1;
-	new->as_npages1 = old->as_npages1;
-	new->as_vbase2 = old->as_vbase2;
-	new->as_npages2 = old->as_npages2;
-
-	
-
-	/* (Mis)use as_prepare_load to allocate some physical memory. */
-	if (as_prepare_load(new)) {
+	#if OPT_A3
+	new->loadelfcompleted = old->loadelfcompleted;
+	new->as_heapbreak = old->as_heapbreak;
+	if (as_copy_regions(old, new)) {
 		as_destroy(new);
 		return ENOMEM;
 	}
 
-	for (int i = 0; i < (int)new->as_npages1; ++i) {
-		memmove((void *)PADDR_TO_KVADDR(new->as_pageTable1[i].frameBasePhysAddr),
-				(const void *)PADDR_TO_KVADDR(old->as_pageTable1[i].frameBasePhysAddr),
-				PAGE_SIZE);
+	//nothing is copied now; whichever side writes a page first gets its own copy
+	for (unsigned d = 0; d < PT_DIRENTRIES; d++) {
+		if (old->as_pagedir[d] != NULL && as_share_leaf(old, new, d)) {
+			as_destroy(new);
+			return ENOMEM;
+		}
 	}
 
-	for (int i = 0; i < (int)new->as_npages2; ++i) {
-		memmove((void *)PADDR_TO_KVADDR(new->as_pageTable2[i].frameBasePhysAddr),
-				(const void *)PADDR_TO_KVADDR(old->as_pageTable2[i].frameBasePhysAddr),
-				PAGE_SIZE);
+	/*
+	 * The parent may still have writable TLB entries for what are now
+	 * shared frames, here or on any cpu it has run on. Rather than
+	 * hunting them down, retire its ASIDs: the old entries can never
+	 * match again, and it picks up a fresh ASID wherever it runs next.
+	 */
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		old->as_asid[i] = 0;
 	}
-
-	for (int i = 0; i < DUMBVM_STACKPAGES; ++i) {
-		memmove((void *)PADDR_TO_KVADDR(new->as_pageTableStack[i].frameBasePhysAddr),
-				(const void *)PADDR_TO_KVADDR(old->as_pageTableStack[i].frameBasePhysAddr),
-				PAGE_SIZE);
+	if (old == curproc_getas()) {
+		as_activate();
 	}
+	#else
+	new->as_vbase1 = old->as_vbase1;
+	new->as_npages1 = old->as_npages1;
+	new->as_vbase2 = old->as_vbase2;
+	new->as_npages2 = old->as_npages2;
+	#endif
 	
 	*ret = new;
 	return 0;
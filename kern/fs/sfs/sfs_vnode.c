@@ -1114,10 +1114,11 @@ sfs_fsync(struct vnode *v)
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
+	/* Pages are read and written through sfs_read and sfs_write. */
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
@@ -37,6 +37,12 @@
 
 #include <vm.h>
 #include "opt-A3.h"
+#if OPT_A3
+#include <spinlock.h>
+#include <platform/maxcpus.h>
+#include <kern/vmstat.h>
+#include <wset.h>
+#endif
 struct vnode;
 
 
@@ -48,7 +54,54 @@ struct vnode;
  */
 
 
+#if OPT_A3
+/*
+ * Where the initialized part of a segment comes from: FILESIZE bytes
+ * at OFFSET in the executable land at VADDR, everything after that up
+ * to the end of the region is zero-filled. VNODE is NULL for regions
+ * with no file behind them.
+ */
+struct segmentBacking {
+  struct vnode *vnode;
+  off_t offset;
+  vaddr_t vaddr;
+  size_t filesize;
+};
+
+/*
+ * A page-aligned range of the address space that may be touched, and
+ * where its pages come from. Regions are kept in a list sorted by
+ * base address.
+ */
+struct region {
+  vaddr_t rg_vbase;
+  size_t rg_npages;
+  int rg_readable;
+  int rg_writeable;
+  int rg_executable;
+  int rg_mapflags; //MAP_ flags if it came from mmap, 0 for the program, heap and stack
+  struct segmentBacking rg_backing;
+  struct region *rg_next;
+};
+#endif
+
 struct addrspace {
+  #if OPT_A3
+  struct region *as_regions; //sorted by base address, stack included
+  struct region *as_heap; //in as_regions, ends at the page holding as_heapbreak; NULL until as_complete_load
+  vaddr_t as_heapbreak; //current break, as sbrk reports it
+  struct region *as_stack; //in as_regions, grows down in vm_fault as far as DUMBVM_STACKLIMIT
+  uint32_t **as_pagedir; //two-level page table, also walked by the UTLB handler, see <machine/vm.h>
+  bool loadelfcompleted; //set to be inititally false, set to be true at end of loadelf, call as_activate() after that
+  struct spinlock as_lock; //protects the page table entries against eviction
+  uint32_t as_asid[MAXCPUS]; //TLB ASID on each cpu, tagged with the cpu's ASID generation
+  vaddr_t as_fa_next; //where the next fault lands if the last fault-around window got used
+  unsigned as_fa_window; //pages to map around the next fault, adapts to sequential access
+  unsigned as_fa_pending; //entries mapped by the last fault-around, not yet counted followed or abandoned
+  struct vmstat as_vmstat; //fault counts and times, under as_lock; vs_resident is filled in by as_getvmstat
+  struct wset as_wset; //working-set estimate and frame allowance, under as_lock
+  struct addrspace *as_next; //on vm_aslist, for finding who maps a text cache frame
+  #else
   vaddr_t as_vbase1;
   //paddr_t as_pbase1;
   size_t as_npages1;
@@ -58,15 +111,6 @@ struct addrspace {
   size_t as_npages2;
   
   //paddr_t as_stackpbase;
-  
-  #if OPT_A3
-  struct pageTableEntry *as_pageTable1;
-  struct pageTableEntry *as_pageTable2;
-  struct pageTableEntry *as_pageTableStack;
-  bool loadelfcompleted; //set to be inititally false, set to be true at end of loadelf, call as_activate() after that
-  int as_readable;
-  int as_writeable;
-  int as_executable;
   #endif
 };
 
@@ -104,6 +148,30 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_backing - record that the region containing VADDR is
+ *                to be filled from FILESIZE bytes of V at OFFSET as
+ *                its pages are first touched. Takes its own reference
+ *                to V.
+ *
+ *    as_sbrk   - move the heap's break by AMOUNT bytes (either way) and
+ *                hand back where it was. Pages are only allocated as
+ *                they're touched; pages given back are freed at once.
+ *
+ *    as_mmap   - map LEN bytes, zero-filled if V is NULL or else from V
+ *                at OFFSET, and hand back where. PROT and FLAGS are as
+ *                in <kern/mman.h>; anonymous mappings must be
+ *                MAP_PRIVATE. Pages come in as they're touched;
+ *                changes to a MAP_SHARED file mapping are written back
+ *                by as_msync, as_munmap and as_destroy.
+ *
+ *    as_munmap - remove the mappings (or the parts of them) in the
+ *                given range, writing back shared changes first.
+ *
+ *    as_msync  - write back shared changes in the given range.
+ *
+ *    as_getvmstat - copy out the address space's fault statistics,
+ *                with the number of pages resident right now.
  */
 
 struct addrspace *as_create(void);
@@ -120,6 +188,19 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3
+int               as_define_backing(struct addrspace *as, vaddr_t vaddr,
+                                    struct vnode *v, off_t offset,
+                                    size_t filesize);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, vaddr_t addr, size_t len,
+                          int prot, int flags, struct vnode *v,
+                          off_t offset, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t addr, size_t len);
+void              as_getvmstat(struct addrspace *as, struct vmstat *vs);
+#endif
 
 
 /*
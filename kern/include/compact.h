@@ -0,0 +1,43 @@
+#ifndef _COMPACT_H_
+#define _COMPACT_H_
+
+/*
+ * Memory compaction: assembling a contiguous run of free frames, when
+ * there's enough memory free but it's all in pieces, by moving user
+ * pages out of the way.
+ *
+ *    compact_bootstrap - called once from vm_bootstrap.
+ *
+ *    compact_alloc  - allocate NPAGES contiguous frames as
+ *                     coremap_alloc would, compacting to make room.
+ *                     Returns 0 if that didn't work either. Sleeps, so
+ *                     only for callers that can.
+ *
+ * Provided by the VM system:
+ *
+ *    vm_migrate     - move the page at VADDR in AS from frame FROM,
+ *                     which the caller has pinned, to the caller's
+ *                     frame TO. Afterwards TO belongs to AS, and the
+ *                     caller should unpin FROM and take it over
+ *                     (coremap_unpin with DISOWN). False if the page
+ *                     has moved on since it was pinned.
+ *
+ *    vm_reclaim     - take text cache frame PADDR back, unmapping it
+ *                     everywhere, and hand it to the caller as
+ *                     coremap_claim would a free one. False if it isn't
+ *                     in the text cache, or somebody still has it.
+ */
+
+struct addrspace;
+
+/* Give up on a block that can't be emptied after this many tries. */
+#define COMPACT_TRIES  4
+
+void    compact_bootstrap(void);
+paddr_t compact_alloc(unsigned long npages);
+
+bool    vm_migrate(struct addrspace *as, vaddr_t vaddr, paddr_t from,
+		   paddr_t to);
+bool    vm_reclaim(paddr_t paddr);
+
+#endif /* _COMPACT_H_ */
@@ -0,0 +1,139 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical frame allocator (the "coremap").
+ *
+ * Frames are handed out by a binary buddy allocator. A block of
+ * order k is 2^k physically contiguous frames whose first frame
+ * number is a multiple of 2^k. Allocation and free are O(log n) in
+ * the number of frames, and a freed block is merged with its buddy
+ * whenever the buddy is also free. Single frames are normally served
+ * from a per-cpu magazine without taking the global lock at all.
+ *
+ *    coremap_bootstrap - take over all physical memory not already
+ *                        grabbed with ram_stealmem. Called once from
+ *                        vm_bootstrap.
+ *
+ *    coremap_alloc     - allocate NPAGES contiguous frames (rounded up
+ *                        to a power of two). Returns the physical
+ *                        address of the first frame, or 0 if no block
+ *                        is large enough.
+ *
+ *    coremap_free      - drop a reference to a block returned by
+ *                        coremap_alloc, releasing it once the last
+ *                        reference is gone. The block's order is
+ *                        remembered in the coremap, so only the first
+ *                        frame is needed. Frames stolen before
+ *                        bootstrap are ignored.
+ *
+ *    coremap_alloc_batch - allocate NPAGES single frames into FRAMES
+ *                        with one trip through the coremap lock. All
+ *                        or nothing; returns 0 or ENOMEM.
+ *
+ *    coremap_free_batch - release NPAGES single frames likewise.
+ *
+ *    coremap_incref    - add a reference to an allocated block, for
+ *                        sharing it copy-on-write. A shared frame has
+ *                        no owner (see coremap_set_owner) and can't be
+ *                        evicted.
+ *
+ *    coremap_refcount  - number of references to an allocated block.
+ *
+ *    coremap_set_owner - record that a single frame holds the user page
+ *                        at VADDR in AS, making it a candidate for
+ *                        eviction. Freeing the frame clears this.
+ *
+ *    coremap_set_cached - record whether a frame belongs to the text
+ *                        cache, which compaction can take frames back
+ *                        from. Freeing the frame clears this.
+ *
+ *    coremap_reserve   - pin an allocated frame with no owner for good:
+ *                        it is never evicted, moved or freed, and so
+ *                        needs no references counted. For the VM's
+ *                        shared zero frame.
+ *
+ *    coremap_touch     - set a user page's reference bits.
+ *
+ *    coremap_sample_ref - whether a user page has been used since the
+ *                        last call, clearing the bit. The working-set
+ *                        sweep's own bit, apart from the clock's.
+ *
+ *    coremap_pick_victim - advance the clock to the next user page that
+ *                        could be evicted. The frame is pinned and
+ *                        returned with its owner and whether it has
+ *                        been referenced since the clock last came by
+ *                        (clearing the bit), or 0 if there is none.
+ *                        Giving referenced pages a second chance is up
+ *                        to the caller.
+ *
+ *    coremap_pin_next  - pin the next user page at or after frame
+ *                        *CURSOR that could be evicted (or merged), as
+ *                        coremap_pick_victim does but without touching
+ *                        the clock or the reference bit, and advance
+ *                        *CURSOR past it. Returns 0 and resets *CURSOR
+ *                        once it reaches the end of memory.
+ *
+ *    coremap_pin       - pin PADDR if it's still such a page, handing
+ *                        back its owner. Never waits.
+ *
+ *    coremap_unpin     - let go of a victim. If DISOWN, it has been
+ *                        evicted and now belongs to the caller as if
+ *                        just allocated; otherwise eviction was
+ *                        abandoned and it stays with its owner.
+ *
+ *    coremap_compact_pick - find the block of 2^ORDER frames that could
+ *                        be freed by moving the fewest user pages out
+ *                        of it: one made up only of free frames,
+ *                        frames that coremap_pin would take, and text
+ *                        cache frames. Returns its first frame, or 0 if
+ *                        there's none.
+ *
+ *    coremap_claim     - allocate the particular frame PADDR, as if by
+ *                        coremap_alloc(1), if it is free. False if not.
+ *
+ *    coremap_join      - turn the 2^ORDER single frames starting at
+ *                        PADDR, all allocated by the caller with no
+ *                        owner, into one block as if allocated with
+ *                        coremap_alloc.
+ *
+ *    coremap_isready   - true once coremap_bootstrap has run; before
+ *                        that, memory comes from ram_stealmem.
+ *
+ *    coremap_stats     - report total and free frame counts.
+ *
+ *    coremap_dump      - print the free lists (for out-of-memory
+ *                        diagnostics with DB_VM on).
+ */
+
+struct addrspace;
+
+/* Largest block handed out or coalesced: 2^COREMAP_MAXORDER frames. */
+#define COREMAP_MAXORDER  10
+
+void    coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+void    coremap_free(paddr_t paddr);
+int     coremap_alloc_batch(unsigned npages, paddr_t *frames);
+void    coremap_free_batch(const paddr_t *frames, unsigned npages);
+void    coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void    coremap_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void    coremap_set_cached(paddr_t paddr, bool cached);
+void    coremap_reserve(paddr_t paddr);
+void    coremap_touch(paddr_t paddr);
+bool    coremap_sample_ref(paddr_t paddr);
+paddr_t coremap_pick_victim(struct addrspace **as, vaddr_t *vaddr,
+			    bool *referenced);
+paddr_t coremap_pin_next(unsigned *cursor, struct addrspace **as,
+			 vaddr_t *vaddr);
+bool    coremap_pin(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr);
+void    coremap_unpin(paddr_t paddr, bool disown);
+paddr_t coremap_compact_pick(unsigned order);
+bool    coremap_claim(paddr_t paddr);
+void    coremap_join(paddr_t paddr, unsigned order);
+bool    coremap_isready(void);
+void    coremap_stats(unsigned *total, unsigned *nfree);
+void    coremap_dump(void);
+
+#endif /* _COREMAP_H_ */
@@ -0,0 +1,30 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap, munmap and msync.
+ */
+
+/* Page protections (mmap PROT argument) */
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+/* Mapping flags (mmap FLAGS argument); one of SHARED or PRIVATE is required */
+#define MAP_SHARED    0x0001   /* Changes go back to the file */
+#define MAP_PRIVATE   0x0002   /* Changes are private to the process */
+#define MAP_FIXED     0x0010   /* Map exactly at ADDR */
+#define MAP_ANON      0x1000   /* No file; zero-filled (FD is ignored) */
+#define MAP_ANONYMOUS MAP_ANON
+
+/* mmap's return value on error */
+#define MAP_FAILED    ((void *)-1)
+
+/* msync flags */
+#define MS_ASYNC      0x0001
+#define MS_SYNC       0x0002
+#define MS_INVALIDATE 0x0004
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,35 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * Per-address-space VM statistics, as returned by getvmstat().
+ *
+ * The fault counters only cover faults the kernel handled; TLB misses
+ * the UTLB handler satisfies from the page table on its own never get
+ * this far, so vs_tlbmisses is the misses that needed vm_fault.
+ *
+ * vs_wsestimate is the pages used in the last working-set sampling
+ * interval, and vs_wsallow the frames the address space may keep
+ * before it has to page out its own (see <wset.h> in the kernel).
+ *
+ * vs_faulthist is a log-scale histogram of how long vm_fault took:
+ * bucket i counts faults that took at least 2^i and less than 2^(i+1)
+ * cycles (bucket 0 also takes the ones that took none).
+ */
+
+#define VS_HISTBUCKETS 32
+
+struct vmstat {
+	unsigned vs_resident;    /* Pages resident right now */
+	unsigned vs_zerofaults;  /* Faults that filled a page with zeros */
+	unsigned vs_filefaults;  /* Faults that read a page from a file */
+	unsigned vs_swapfaults;  /* Faults that read a page back from swap */
+	unsigned vs_tlbmisses;   /* TLB misses that came to vm_fault */
+	unsigned vs_cowbreaks;   /* Copy-on-write pages copied on a write */
+	unsigned vs_wsestimate;  /* Working-set estimate, in pages */
+	unsigned vs_wsallow;     /* Resident-frame allowance */
+	unsigned vs_faulthist[VS_HISTBUCKETS];
+};
+
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -0,0 +1,41 @@
+#ifndef _KSM_H_
+#define _KSM_H_
+
+/*
+ * Same-page merging: a kernel thread that looks for user pages with
+ * identical contents (typically left behind by fork) and makes them
+ * share one copy-on-write frame, giving the rest back to the coremap.
+ * It is off until started.
+ *
+ *    ksm_setrate    - scan up to RATE pages a second, starting the
+ *                     scanner if it isn't running. A RATE of 0 stops
+ *                     it and lets go of every frame it was holding.
+ *
+ * Provided by the VM system for the scanner. In both, PADDR/FROM is a
+ * frame holding the page at VADDR in AS that the caller has pinned
+ * (see coremap_pin):
+ *
+ *    vm_ksm_share   - make the page copy-on-write and add a reference
+ *                     to its frame for the caller, so that the frame
+ *                     can be merged into. False if the page has moved
+ *                     on since it was pinned.
+ *
+ *    vm_ksm_merge   - if the page is (still) identical to frame INTO,
+ *                     on which the caller holds a reference, map INTO
+ *                     copy-on-write in its place. FROM is then no
+ *                     longer mapped, and the caller should disown and
+ *                     free it. False if the page differs or has moved
+ *                     on.
+ */
+
+struct addrspace;
+
+#define KSM_DEFAULT_RATE  100
+
+int  ksm_setrate(unsigned rate);
+
+bool vm_ksm_share(struct addrspace *as, vaddr_t vaddr, paddr_t paddr);
+bool vm_ksm_merge(struct addrspace *as, vaddr_t vaddr, paddr_t from,
+		  paddr_t into);
+
+#endif /* _KSM_H_ */
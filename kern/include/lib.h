@@ -144,6 +144,7 @@ char *strtok_r(char *buf, const char *seps, char **context);
 
 void *memcpy(void *dest, const void *src, size_t len);
 void *memmove(void *dest, const void *src, size_t len);
+int memcmp(const void *a, const void *b, size_t len);
 void bzero(void *ptr, size_t len);
 int atoi(const char *str);
 
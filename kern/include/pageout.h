@@ -0,0 +1,47 @@
+#ifndef _PAGEOUT_H_
+#define _PAGEOUT_H_
+
+/*
+ * Page-out daemon: a kernel thread that frees frames in the background
+ * once free memory drops below a low watermark, and keeps at it until
+ * it is back above a high one, so that allocations seldom have to
+ * evict pages themselves.
+ *
+ *    pageout_bootstrap  - set the watermarks from the size of memory
+ *                         and start the thread. Called once from
+ *                         vm_bootstrap.
+ *
+ *    pageout_check      - wake the daemon if free memory is below the
+ *                         low watermark. Called after allocating
+ *                         frames. Doesn't sleep.
+ *
+ *    pageout_short      - whether free memory is below the low
+ *                         watermark. Doesn't sleep.
+ *
+ *    pageout_setwater   - change the watermarks, in frames. EINVAL
+ *                         unless LOW <= HIGH <= the size of memory.
+ *
+ *    pageout_printstats - print the watermarks, free memory, and what
+ *                         the daemon has reclaimed and how fast.
+ *
+ * Provided by the VM system for the daemon:
+ *
+ *    vm_pageout         - evict one user page and free its frame. Sets
+ *                         *CLEAN if it was a clean file page that could
+ *                         just be dropped rather than written to swap.
+ *                         False if there was nothing to evict.
+ */
+
+/* Default watermarks, as fractions of memory; see also ZEROPOOL_RESERVEDIV */
+#define PAGEOUT_LOWDIV   16
+#define PAGEOUT_HIGHDIV  8
+
+void pageout_bootstrap(void);
+void pageout_check(void);
+bool pageout_short(void);
+int  pageout_setwater(unsigned low, unsigned high);
+void pageout_printstats(void);
+
+bool vm_pageout(bool *clean);
+
+#endif /* _PAGEOUT_H_ */
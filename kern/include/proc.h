@@ -55,7 +55,8 @@ extern struct lock *process_list_lock;
 void handlePIDpcrelationship(struct proc *parent_process, struct proc *child_process);
 bool inProcessList(unsigned int PID);
 struct proc *getChild(struct proc *parent_process, unsigned int PID);
-void removeFromProcessList(unsigned int PID);
+void addToProcessList(struct proc *p);
+void removeFromProcessList(struct proc *p);
 void handleChildrenOnDeath(struct proc *p);
 #endif
 
@@ -0,0 +1,45 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Backing store for evicted user pages.
+ *
+ * The swap area is a raw disk device (SWAP_DEVICE) divided into
+ * page-sized slots; a bitmap records which slots are in use. A slot
+ * can be shared by several page table entries (after fork), and is
+ * only released once the last of them lets go.
+ *
+ *    swap_bootstrap - open the swap device. If it isn't there paging
+ *                     is disabled and everything else here fails
+ *                     with ENOSPC. Called once from vm_bootstrap.
+ *
+ *    swap_alloc     - reserve a free slot, with one reference. Returns
+ *                     0 or ENOSPC.
+ *
+ *    swap_share     - add a reference to a slot. Its contents must not
+ *                     change from here on; each holder reads its own
+ *                     copy back in.
+ *
+ *    swap_free      - drop a reference to a slot, releasing it if that
+ *                     was the last. Doesn't sleep.
+ *
+ *    swap_out       - write the frame at PADDR to SLOT. It goes to the
+ *                     compressed swap cache if it fits there, and to
+ *                     the disk otherwise.
+ *
+ *    swap_in        - read SLOT into the frame at PADDR.
+ *
+ * swap_in and swap_out sleep for the disk, so must not be called with
+ * spinlocks held.
+ */
+
+#define SWAP_DEVICE  "lhd1raw:"
+
+void swap_bootstrap(void);
+int  swap_alloc(unsigned *slot);
+void swap_share(unsigned slot);
+void swap_free(unsigned slot);
+int  swap_out(paddr_t paddr, unsigned slot);
+int  swap_in(unsigned slot, paddr_t paddr);
+
+#endif /* _SWAP_H_ */
@@ -69,6 +69,12 @@ int sys_execv(userptr_t progname, userptr_t args);
 #endif
 #if OPT_A3
 void sys_kill(int exitcode);
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_getvmstat(userptr_t buf);
 #endif
 #endif // UW
 
@@ -74,6 +74,7 @@ int readstress(int, char **);
 int writestress(int, char **);
 int writestress2(int, char **);
 int createstress(int, char **);
+int mmaptest(int, char **);
 int printfile(int, char **);
 
 /* other tests */
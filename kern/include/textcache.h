@@ -0,0 +1,54 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Cache of read-only executable pages, so that every process running
+ * the same program maps the same frames for its text.
+ *
+ * Pages are named by the executable's vnode and the page's virtual
+ * address; the contents of such a page are the same in every address
+ * space loaded from that vnode. A cached frame stays in the cache
+ * exactly as long as somebody maps it. The cache holds no reference
+ * to the vnode: every frame in it is mapped by some address space
+ * whose regions do.
+ *
+ * Cached frames are never owned (see coremap_set_owner), so the clock
+ * never picks them; they are taken back whole with textcache_reclaim
+ * instead, once the VM has nothing else to evict, or when compaction
+ * wants the frame.
+ *
+ *    textcache_lookup  - find the frame for page VADDR of V, adding a
+ *                        reference to it for the caller. 0 if it isn't
+ *                        cached.
+ *
+ *    textcache_insert  - offer freshly loaded frame PADDR (with one
+ *                        reference, the caller's) as page VADDR of V.
+ *                        Returns the frame the caller should map: PADDR,
+ *                        or one somebody else cached first (in which
+ *                        case PADDR has been freed and the caller has a
+ *                        reference to the other one instead). Returns 0
+ *                        and leaves PADDR alone if there's no memory
+ *                        to cache it.
+ *
+ *    textcache_release - drop a mapper's reference to PADDR, cached as
+ *                        page VADDR of V, taking it out of the cache if
+ *                        it was the last. PADDR may already have been
+ *                        reclaimed. Doesn't sleep.
+ *
+ *    textcache_reclaim - take frame PADDR, or if PADDR is 0 the next one
+ *                        round the cache, out of the cache, so nothing
+ *                        new can map it, adding a reference for the
+ *                        caller. Sets *VADDR to where it is mapped. The
+ *                        caller then unmaps it from its mappers. Returns
+ *                        the frame, or 0 if it isn't cached (or the cache
+ *                        is empty). Doesn't sleep.
+ */
+
+struct vnode;
+
+paddr_t textcache_lookup(struct vnode *v, vaddr_t vaddr);
+paddr_t textcache_insert(struct vnode *v, vaddr_t vaddr, paddr_t paddr);
+void    textcache_release(struct vnode *v, vaddr_t vaddr, paddr_t paddr);
+paddr_t textcache_reclaim(paddr_t paddr, vaddr_t *vaddr);
+
+#endif /* _TEXTCACHE_H_ */
@@ -36,7 +36,30 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#define VMSTAT_ZERO_POOL_HIT         (10)
+#define VMSTAT_ZERO_POOL_MISS        (11)
+#define VMSTAT_FAULTAROUND_FOLLOWED  (12)
+#define VMSTAT_FAULTAROUND_ABANDONED (13)
+#define VMSTAT_TLB_SHOOTDOWN         (14)
+#define VMSTAT_TLB_SHOOTDOWN_IPI     (15)
+#define VMSTAT_ZERO_PAGE_HIT         (16)
+#define VMSTAT_KSM_SCANNED          (17)
+#define VMSTAT_KSM_MERGED           (18)
+#define VMSTAT_KSM_UNMERGED         (19)
+#define VMSTAT_ZSWAP_STORE          (20)
+#define VMSTAT_ZSWAP_OVERFLOW       (21)
+#define VMSTAT_ZSWAP_HIT            (22)
+#define VMSTAT_ZSWAP_BYTES          (23)
+#define VMSTAT_PAGEOUT              (24)
+#define VMSTAT_PAGEOUT_DIRECT       (25)
+#define VMSTAT_PAGEOUT_CLEAN        (26)
+#define VMSTAT_COMPACT_MIGRATE      (27)
+#define VMSTAT_COMPACT_SUCCESS      (28)
+#define VMSTAT_COMPACT_FAIL         (29)
+#define VMSTAT_WSET_TRIM            (30)
+#define VMSTAT_WSET_GROW            (31)
+#define VMSTAT_WSET_SHRINK          (32)
+#define VMSTAT_COUNT                 (33)
 
 /* ----------------------------------------------------------------------- */
 
@@ -52,6 +75,13 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
 void vmstats_inc(unsigned int index);    /* uses locking */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
+/* Add to the specified count, for counts of something other than events
+ * Example use:
+ *   vmstats_add(VMSTAT_ZSWAP_BYTES, len);
+ */
+void vmstats_add(unsigned int index, unsigned int n);    /* uses locking */
+void _vmstats_add(unsigned int index, unsigned int n);   /* atomicity must be ensured elsewhere */
+
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
 
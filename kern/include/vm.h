@@ -54,6 +54,30 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+#if OPT_A3
+/*
+ * Allocate/free NPAGES separate single pages at once, taking the
+ * coremap lock only once. alloc_kpages_batch is all or nothing and
+ * returns 0 or ENOMEM.
+ */
+int alloc_kpages_batch(unsigned npages, vaddr_t *addrs);
+void free_kpages_batch(const vaddr_t *addrs, unsigned npages);
+
+/*
+ * Print each process's VM statistics (see <kern/vmstat.h>) and the
+ * system-wide histogram of fault service times.
+ */
+void vm_printstats(void);
+#endif
+
+/*
+ * Background work for an idle cpu, called from the idle loop with
+ * interrupts off. Does a little at a time; returns true if it did
+ * anything, in which case the caller should look for runnable threads
+ * again rather than idle.
+ */
+bool vm_idle(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
@@ -0,0 +1,72 @@
+#ifndef _WSET_H_
+#define _WSET_H_
+
+/*
+ * Working-set estimation and page-fault-frequency control: each
+ * address space gets an allowance of resident frames, grown while it
+ * faults a lot and shrunk towards its working set while it doesn't,
+ * so one process can't take over memory at the others' expense.
+ *
+ *    wset_bootstrap - size the budget from free memory and start the
+ *                     sweep thread. Called once from vm_bootstrap.
+ *
+ *    wset_init      - set up a new address space's state, with an
+ *                     opening allowance.
+ *
+ *    wset_adjust    - the controller. Given what a sweep found (the
+ *                     frames the address space holds and how many of
+ *                     those it used since the last sweep), update its
+ *                     allowance from the frames it faulted in since.
+ *                     Returns how many frames it holds beyond the
+ *                     new allowance while memory is short, and 0
+ *                     otherwise. Doesn't sleep.
+ *
+ * Provided by the VM system for the sweep thread:
+ *
+ *    vm_wset_sweep  - go through every address space, sampling and
+ *                     clearing reference bits and calling wset_adjust,
+ *                     and page out unused pages of the ones over their
+ *                     allowance, without holding process_list_lock
+ *                     for the I/O. Clearing a reference bit also clears
+ *                     TLBLO_VALID, so each resident page costs one
+ *                     extra vm_fault per WSET_INTERVAL it is used in.
+ */
+
+/* Seconds between sweeps */
+#define WSET_INTERVAL  1
+
+/* Frames faulted in per interval above which the allowance grows... */
+#define WSET_PFFHIGH   32
+/* ...and below which it shrinks */
+#define WSET_PFFLOW    4
+
+/* Smallest allowance; a new address space starts at 1/WSET_INITDIV of the budget */
+#define WSET_MINALLOW  16
+#define WSET_INITDIV   4
+
+/* Most frames one sweep pages out of one address space, and in all */
+#define WSET_TRIMMAX   32
+#define WSET_SWEEPMAX  128
+
+/*
+ * Per-address-space state, under the address space's lock. Only
+ * frames the address space has to itself count; shared ones can't be
+ * paged out anyway.
+ */
+struct wset {
+	unsigned ws_allow;	/* frames it may keep */
+	unsigned ws_resident;	/* frames it held at the last sweep */
+	unsigned ws_estimate;	/* of those, used since the sweep before */
+	unsigned ws_faults;	/* frames faulted in since the last sweep */
+	unsigned ws_cursor;	/* page directory slot the sweep is up to */
+	unsigned ws_sampled;	/* frames it has found there so far... */
+	unsigned ws_used;	/* ...and of those, used since the last sweep */
+};
+
+void     wset_bootstrap(void);
+void     wset_init(struct wset *ws);
+unsigned wset_adjust(struct wset *ws, unsigned resident, unsigned referenced);
+
+void vm_wset_sweep(void);
+
+#endif /* _WSET_H_ */
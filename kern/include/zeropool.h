@@ -0,0 +1,42 @@
+#ifndef _ZEROPOOL_H_
+#define _ZEROPOOL_H_
+
+/*
+ * Frames zeroed ahead of time by idle cpus, so that pages which start
+ * out zero-filled don't have to be cleared on the fault path.
+ *
+ * The pool is topped up to a high watermark once it falls below a low
+ * one; both scale with the size of memory (ZEROPOOL_MAX is the most it
+ * will ever hold). Frames are only taken for it while more than
+ * 1/ZEROPOOL_RESERVEDIV of memory is free.
+ *
+ *    zeropool_bootstrap - size the pool. Called once from vm_bootstrap,
+ *                     after coremap_bootstrap.
+ *
+ *    zeropool_get   - take a zeroed frame, allocated as if by
+ *                     coremap_alloc(1), or 0 if the pool is empty.
+ *
+ *    zeropool_fill  - zero one more frame for the pool if it needs
+ *                     topping up. Returns true if it did anything.
+ *                     Called from the idle loop, so it's quick and
+ *                     doesn't sleep.
+ *
+ *    zeropool_drain - give all pooled frames back to the coremap, for
+ *                     when memory runs short. Returns how many.
+ */
+
+#define ZEROPOOL_MAX  64
+
+/*
+ * Between the page-out daemon's default watermarks (see pageout.h), so
+ * the pool can fill from what the daemon frees, and filling it never
+ * takes free memory down to where the daemon wakes up.
+ */
+#define ZEROPOOL_RESERVEDIV  12
+
+void     zeropool_bootstrap(void);
+paddr_t  zeropool_get(void);
+bool     zeropool_fill(void);
+unsigned zeropool_drain(void);
+
+#endif /* _ZEROPOOL_H_ */
@@ -0,0 +1,40 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+/*
+ * Compressed swap cache: a RAM tier in front of the swap disk.
+ *
+ * Pages written to swap are compressed into an arena of frames, and
+ * only go out to the disk if they don't compress well or the arena is
+ * full. The arena takes frames as pages are stored, up to
+ * ZSWAP_PERCENT of memory, and gives them all back whenever it empties,
+ * so it costs nothing while nothing is being swapped. A page cached here still
+ * has its swap slot, which names it; the disk copy of the slot is
+ * just never written. Pages filled with a single repeated word take
+ * no arena space at all.
+ *
+ *    zswap_bootstrap - set up for a swap area of NSLOTS slots, with
+ *                     an empty arena. Called once from
+ *                     swap_bootstrap.
+ *
+ *    zswap_store    - keep the page in frame PADDR as slot SLOT.
+ *                     False if it has to go to the disk instead.
+ *
+ *    zswap_load     - copy slot SLOT into frame PADDR if it is cached
+ *                     here. The copy stays cached until zswap_drop.
+ *
+ *    zswap_drop     - forget slot SLOT, if it is cached.
+ *
+ * zswap_store and zswap_load may sleep waiting for scratch space;
+ * zswap_drop doesn't sleep.
+ */
+
+/* Most of memory the arena may take; 0 caches same-filled pages only */
+#define ZSWAP_PERCENT  12
+
+void zswap_bootstrap(unsigned nslots);
+bool zswap_store(unsigned slot, paddr_t paddr);
+bool zswap_load(unsigned slot, paddr_t paddr);
+void zswap_drop(unsigned slot);
+
+#endif /* _ZSWAP_H_ */
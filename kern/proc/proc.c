@@ -194,7 +194,7 @@ proc_destroy(struct proc *proc)
 	cv_destroy(proc->process_cv);
 	array_setsize(proc->children_list,0);
 	array_destroy(proc->children_list);
-	removeFromProcessList(proc->self_pid);
+	removeFromProcessList(proc);
 	handleChildrenOnDeath(proc);
 #endif
 
@@ -437,10 +437,20 @@ void handlePIDpcrelationship(struct proc* parent_process, struct proc* child_pro
 	//array_add(process_list, child_process, NULL);
 	//TODO:
   lock_release(parent_process->proc_lock);
+	addToProcessList(child_process);
+
+}
+
+/*
+ * Forked processes are added by handlePIDpcrelationship; the one the
+ * menu starts (PID 2) is added by common_prog, so that everything that
+ * walks the list (the VM's working-set sweep and statistics) sees every
+ * user process.
+ */
+void addToProcessList(struct proc *p) {
 	lock_acquire(process_list_lock);
-	array_add(process_list, child_process, NULL);
+	array_add(process_list, p, NULL);
 	lock_release(process_list_lock);
-
 }
 
 bool inProcessList(unsigned int PID) {
@@ -469,12 +479,17 @@ struct proc *getChild(struct proc *parent_process, unsigned int PID) {
 	return NULL;	   
 }	
 
-void removeFromProcessList(unsigned int PID){
+/*
+ * Matches by pointer, not PID: a fork that fails before the child gets
+ * its PID destroys a child that still has the menu process's PID 2.
+ */
+void removeFromProcessList(struct proc *p){
+	unsigned int PID = p->self_pid;
 	lock_acquire(process_list_lock);
 	int lengthProcessList = array_num(process_list);
 	for (int i=0; i < lengthProcessList; ++i) {
 		struct proc* temp_proc = (struct proc *)array_get(process_list, i);
-		if (temp_proc->self_pid == PID)	{
+		if (temp_proc == p)	{
 			//DEBUG(DB_EXEC, "Length of ProcessList before deletion: %d\n", array_num(process_list));
 			array_remove(process_list, i);
 			//DEBUG(DB_EXEC, "Length of ProcessList after deletion: %d\n", array_num(process_list));
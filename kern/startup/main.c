@@ -50,6 +50,10 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-A3.h"
+#if OPT_A3
+#include <uw-vmstats.h>
+#endif
 
 
 /*
@@ -146,6 +150,10 @@ shutdown(void)
 {
 
 	kprintf("Shutting down.\n");
+
+#if OPT_A3
+	vmstats_print();
+#endif
 	
 	vfs_clearbootfs();
 	vfs_clearcurdir();
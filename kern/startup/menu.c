@@ -45,6 +45,13 @@
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <ksm.h>
+#include <pageout.h>
+#include <vm.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -141,6 +148,9 @@ common_prog(int nargs, char **args)
 	if (proc == NULL) {
 		return ENOMEM;
 	}
+#if OPT_A2
+	addToProcessList(proc);
+#endif
 
 	result = thread_fork(args[0] /* thread name */,
 			proc /* new process */,
@@ -413,6 +423,77 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_A3
+/*
+ * Command for starting, retuning or (with a rate of 0) stopping the
+ * same-page merging scanner.
+ */
+static
+int
+cmd_ksm(int nargs, char **args)
+{
+	int rate = KSM_DEFAULT_RATE;
+
+	if (nargs > 2) {
+		kprintf("Usage: ksm [pages-per-second]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		rate = atoi(args[1]);
+		if (rate < 0) {
+			kprintf("Usage: ksm [pages-per-second]\n");
+			return EINVAL;
+		}
+	}
+
+	return ksm_setrate(rate);
+}
+
+/*
+ * Command for the page-out daemon: print its stats, or with two
+ * arguments set the low and high free-frame watermarks first.
+ */
+static
+int
+cmd_pageoutstats(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 1 && nargs != 3) {
+		kprintf("Usage: po [low-frames high-frames]\n");
+		return EINVAL;
+	}
+	if (nargs == 3) {
+		if (atoi(args[1]) < 0 || atoi(args[2]) < 0) {
+			kprintf("Usage: po [low-frames high-frames]\n");
+			return EINVAL;
+		}
+		result = pageout_setwater(atoi(args[1]), atoi(args[2]));
+		if (result) {
+			return result;
+		}
+	}
+
+	pageout_printstats();
+	return 0;
+}
+
+/*
+ * Command for printing each process's VM statistics and the fault
+ * time histogram.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+	return 0;
+}
+#endif /* OPT_A3 */
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -455,6 +536,9 @@ static const char *opsmenu[] = {
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	"[dth]     enable output for DB_THREADS",
+#if OPT_A3
+	"[ksm]     Page merging scanner      ",
+#endif
 	NULL
 };
 
@@ -492,6 +576,9 @@ static const char *testmenu[] = {
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+#if OPT_A3
+	"[fs6] mmap write-back test  (3)     ",
+#endif
 	NULL
 };
 
@@ -524,6 +611,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_A3
+	"[po] Page-out daemon stats          ",
+	"[vs] Per-process VM stats           ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -569,6 +660,9 @@ static struct {
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
+#if OPT_A3
+	{ "ksm",	cmd_ksm },
+#endif
 
 #if OPT_SYNCHPROBS
 	/* in-kernel synchronization problem(s) */
@@ -581,6 +675,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_A3
+	{ "po",         cmd_pageoutstats },
+	{ "vs",         cmd_vmstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -609,6 +707,9 @@ static struct {
 	{ "fs3",	writestress },
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
+#if OPT_A3
+	{ "fs6",	mmaptest },
+#endif
 
 	{ NULL, NULL }
 };
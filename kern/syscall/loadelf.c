@@ -73,6 +73,11 @@
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
+ *
+ * Under OPT_A3 nothing is read here: the segment is just attached to
+ * its region and vm_fault reads each page from V when it is first
+ * touched. Since that bypasses uiomove, the kernel-space check is
+ * done by hand.
  */
 static
 int
@@ -90,6 +95,15 @@ load_segment(struct addrspace *as, struct vnode *v,
 		filesize = memsize;
 	}
 
+	#if OPT_A3
+	if (vaddr >= USERSPACETOP || memsize > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n", 
+	      (unsigned long) filesize, (unsigned long) vaddr);
+	return as_define_backing(as, vaddr, v, offset, filesize);
+	#endif
+
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
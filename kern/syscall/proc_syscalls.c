@@ -12,6 +12,10 @@
 #include "opt-A2.h"
 #include "mips/trapframe.h" 
 #include "opt-A3.h"
+#if OPT_A3
+#include <kern/mman.h>
+#include <kern/vmstat.h>
+#endif
 #if OPT_A2
 #include <kern/fcntl.h>
 #include <vm.h>
@@ -70,6 +74,83 @@ void sys_kill(int exitcode) {
 
 }
 
+/* handler for sbrk() system call: the heap lives in the address space */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  struct addrspace *as = curproc_getas();
+
+  if (as == NULL) {
+    return ENOMEM;
+  }
+  return as_sbrk(as, amount, retval);
+}
+
+/* handler for mmap() system call */
+/*
+ * n.b.
+ * There is no open file table yet, so only anonymous mappings can be
+ * made from here; as_mmap itself takes a vnode for file mappings.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+         off_t offset, vaddr_t *retval)
+{
+  struct addrspace *as = curproc_getas();
+
+  (void)fd;
+  if (as == NULL) {
+    return ENOMEM;
+  }
+  if ((flags & MAP_ANON) == 0) {
+    return EBADF;
+  }
+  return as_mmap(as, (vaddr_t)addr, len, prot, flags, NULL, offset, retval);
+}
+
+/* handler for munmap() system call */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+  struct addrspace *as = curproc_getas();
+
+  if (as == NULL) {
+    return EINVAL;
+  }
+  return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/* handler for msync() system call */
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+  struct addrspace *as = curproc_getas();
+
+  if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+      (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+    return EINVAL;
+  }
+  if (as == NULL) {
+    return EINVAL;
+  }
+  /* writes go out right away, so MS_ASYNC is as good as MS_SYNC */
+  return as_msync(as, (vaddr_t)addr, len);
+}
+
+/* handler for getvmstat() system call */
+int
+sys_getvmstat(userptr_t buf)
+{
+  struct addrspace *as = curproc_getas();
+  struct vmstat vs;
+
+  if (as == NULL) {
+    return EINVAL;
+  }
+  as_getvmstat(as, &vs);
+  return copyout(&vs, buf, sizeof(vs));
+}
+
 #endif
 
 void sys__exit(int exitcode) {
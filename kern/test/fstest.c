@@ -49,6 +49,14 @@
 #include <fs.h>
 #include <vnode.h>
 #include <test.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <kern/mman.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vm.h>
+#endif
 
 #define SLOGAN   "HODIE MIHI - CRAS TIBI\n"
 #define FILENAME "fstest.tmp"
@@ -544,7 +552,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[12345] filesystem:\n");
+		kprintf("Usage: fs[123456] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -571,11 +579,190 @@ checkfilesystem(int nargs, char **args)
 	return 0;                                 \
   }
 
+#if OPT_A3
+////////////////////////////////////////////////////////////
+//
+// mmap test
+//
+// Maps a file MAP_SHARED into an address space of our own (borrowed by
+// the menu thread for the duration), checks that its pages fault in
+// from the file, changes one, and checks that as_msync writes the
+// change back and leaves the other page alone.
+
+#define MMAP_SUFFIX "-mmap"
+#define MMAP_PAGES  2
+
+static
+char
+mmap_expect(unsigned page, unsigned i, bool changed)
+{
+	return (changed ? 'a' : 'A') + (page + i) % 26;
+}
+
+/*
+ * Read page PAGE of VN into BUF and check it against mmap_expect.
+ */
+static
+int
+mmap_checkfile(struct vnode *vn, char *buf, unsigned page, bool changed)
+{
+	struct iovec iov;
+	struct uio ku;
+	unsigned i;
+	int err;
+
+	uio_kinit(&iov, &ku, buf, PAGE_SIZE, page * PAGE_SIZE, UIO_READ);
+	err = VOP_READ(vn, &ku);
+	if (err) {
+		kprintf("mmaptest: read error: %s\n", strerror(err));
+		return -1;
+	}
+	for (i=0; i<PAGE_SIZE; i++) {
+		if (buf[i] != mmap_expect(page, i, changed)) {
+			kprintf("mmaptest: file page %u byte %u is wrong\n", page, i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static
+int
+mmap_run(struct vnode *vn, char *buf)
+{
+	struct addrspace *as, *oldas;
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t base;
+	unsigned page, i;
+	int err, ret = -1;
+
+	for (page=0; page<MMAP_PAGES; page++) {
+		for (i=0; i<PAGE_SIZE; i++) {
+			buf[i] = mmap_expect(page, i, false);
+		}
+		uio_kinit(&iov, &ku, buf, PAGE_SIZE, page * PAGE_SIZE, UIO_WRITE);
+		err = VOP_WRITE(vn, &ku);
+		if (err || ku.uio_resid > 0) {
+			kprintf("mmaptest: write error: %s\n",
+				err ? strerror(err) : "short write");
+			return -1;
+		}
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		kprintf("mmaptest: as_create failed\n");
+		return -1;
+	}
+	oldas = curproc_setas(as);
+	as_activate();
+
+	err = as_mmap(as, 0, MMAP_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, vn, 0, &base);
+	if (err) {
+		kprintf("mmaptest: as_mmap: %s\n", strerror(err));
+		goto out;
+	}
+
+	/* Fault the pages in through the mapping. */
+	for (page=0; page<MMAP_PAGES; page++) {
+		err = copyin((const_userptr_t)(base + page * PAGE_SIZE), buf, PAGE_SIZE);
+		if (err) {
+			kprintf("mmaptest: copyin: %s\n", strerror(err));
+			goto out;
+		}
+		for (i=0; i<PAGE_SIZE; i++) {
+			if (buf[i] != mmap_expect(page, i, false)) {
+				kprintf("mmaptest: mapped page %u byte %u is wrong\n",
+					page, i);
+				goto out;
+			}
+		}
+	}
+
+	/* Change the first page only, and write it back. */
+	for (i=0; i<PAGE_SIZE; i++) {
+		buf[i] = mmap_expect(0, i, true);
+	}
+	err = copyout(buf, (userptr_t)base, PAGE_SIZE);
+	if (err) {
+		kprintf("mmaptest: copyout: %s\n", strerror(err));
+		goto out;
+	}
+	err = as_msync(as, base, MMAP_PAGES * PAGE_SIZE);
+	if (err) {
+		kprintf("mmaptest: as_msync: %s\n", strerror(err));
+		goto out;
+	}
+	if (mmap_checkfile(vn, buf, 0, true) || mmap_checkfile(vn, buf, 1, false)) {
+		goto out;
+	}
+
+	err = as_munmap(as, base, MMAP_PAGES * PAGE_SIZE);
+	if (err) {
+		kprintf("mmaptest: as_munmap: %s\n", strerror(err));
+		goto out;
+	}
+	ret = 0;
+
+ out:
+	as_deactivate();
+	curproc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+	return ret;
+}
+
+static
+void
+dommaptest(const char *filesys)
+{
+	struct vnode *vn;
+	char name[32];
+	char buf[32];
+	char *page;
+	int err;
+
+	kprintf("*** Starting mmap test on %s:\n", filesys);
+
+	page = kmalloc(PAGE_SIZE);
+	if (page == NULL) {
+		kprintf("*** Test failed: out of memory\n");
+		return;
+	}
+
+	fstest_makename(name, sizeof(name), filesys, MMAP_SUFFIX);
+	/* vfs_open destroys the string it's passed */
+	strcpy(buf, name);
+	err = vfs_open(buf, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		kprintf("Could not open %s: %s\n", name, strerror(err));
+		kfree(page);
+		kprintf("*** Test failed\n");
+		return;
+	}
+
+	err = mmap_run(vn, page);
+	vfs_close(vn);
+	kfree(page);
+	if (fstest_remove(filesys, MMAP_SUFFIX) || err) {
+		kprintf("*** Test failed\n");
+		return;
+	}
+
+	kprintf("*** mmap test done\n");
+}
+#endif /* OPT_A3 */
+
 DEFTEST(fstest);
 DEFTEST(readstress);
 DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(createstress);
+#if OPT_A3
+DEFTEST(mmaptest);
+#endif
 
 ////////////////////////////////////////////////////////////
 
@@ -218,7 +218,7 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
-          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_SWAP_FILE_READ */
+          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_SWAP_FILE_READ + VMSTAT_ZSWAP_HIT */
           case VMSTAT_PAGE_FAULT_DISK:
             if (i % 2 == 0) {
                vmstats_inc(j);
@@ -231,8 +231,9 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
+          /* Swap-ins split between the swap file and the compressed cache */
           case VMSTAT_SWAP_FILE_READ:
-            if (i % 4 == 0) {
+            if (i % 8 == 0) {
                vmstats_inc(j);
             }
             break;
@@ -243,6 +244,126 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
+          /* Only reported as rates and totals from here on */
+          case VMSTAT_ZERO_POOL_HIT:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_ZERO_POOL_MISS:
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_FAULTAROUND_FOLLOWED:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_FAULTAROUND_ABANDONED:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_TLB_SHOOTDOWN:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_TLB_SHOOTDOWN_IPI:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_ZERO_PAGE_HIT:
+            if (i % 3 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_KSM_SCANNED:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_KSM_MERGED:
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_KSM_UNMERGED:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZSWAP_STORE:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_ZSWAP_OVERFLOW:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          /* The other half of the swap-ins, see VMSTAT_SWAP_FILE_READ */
+          case VMSTAT_ZSWAP_HIT:
+            if (i % 8 == 1) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZSWAP_BYTES:
+            vmstats_add(j, 1024);
+            break;
+
+          case VMSTAT_PAGEOUT:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_PAGEOUT_DIRECT:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_PAGEOUT_CLEAN:
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_COMPACT_MIGRATE:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_COMPACT_SUCCESS:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_COMPACT_FAIL:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_WSET_TRIM:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_WSET_GROW:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_WSET_SHRINK:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
           default:
             kprintf("Unknown stat %d\n", j);
             break;
@@ -48,6 +48,7 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <mainbus.h>
 #include <vnode.h>
 
@@ -624,6 +625,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * interrupt from another cpu posting a wakeup) and idling
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
+	 * Before actually idling, give the VM system a chance to do
+	 * some background work (vm_idle); if it did any, check the
+	 * runqueue again first.
+	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
@@ -635,7 +640,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!vm_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1162,6 +1169,23 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+unsigned
+ipi_tlbshootdown_mask(const struct tlbshootdown *mapping, uint32_t cpumask)
+{
+	unsigned i, n = 0;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self &&
+		    (cpumask & ((uint32_t)1 << c->c_number)) != 0) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -246,10 +246,11 @@ null_fsync(struct vnode *v)
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v)
 {
+	/* No device here has memory that can be mapped. */
 	(void)v;
-	return EUNIMP;
+	return ENODEV;
 }
 
 /*
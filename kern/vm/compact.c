@@ -0,0 +1,159 @@
+/*
+ * Memory compaction.
+ *
+ * To empty a block, first every free frame in it is claimed, so that
+ * nothing else (including the frames we move pages to) can be
+ * allocated there. Then each user page in it is moved to a frame from
+ * coremap_alloc and its old frame claimed in turn. Text cache frames
+ * aren't moved but reclaimed: the VM unmaps them everywhere, and the
+ * next use reads them back from the file. Pages can be freed
+ * while this is going on, in which case their frames are claimed too.
+ * Once the whole block is ours it is joined up and handed out; if any
+ * frame can't be had, everything claimed so far goes back.
+ *
+ * One compaction at a time; two going for the same block would only
+ * get in each other's way.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <compact.h>
+#include <uw-vmstats.h>
+
+static struct lock *compact_lock;
+
+void
+compact_bootstrap(void)
+{
+	compact_lock = lock_create("compact");
+	if (compact_lock == NULL) {
+		panic("compact_bootstrap: out of memory\n");
+	}
+}
+
+/*
+ * Get a frame to move a page from the block at BASE to. Frames that
+ * turn out to be in the block are kept, marked in CLAIMED. Returns 0
+ * if memory is exhausted.
+ */
+static
+paddr_t
+compact_target(paddr_t base, unsigned npages, uint32_t *claimed)
+{
+	paddr_t paddr;
+	unsigned i;
+
+	while ((paddr = coremap_alloc(1)) != 0) {
+		if (paddr < base || paddr >= base + npages * PAGE_SIZE) {
+			break;
+		}
+		i = (paddr - base) / PAGE_SIZE;
+		claimed[i / 32] |= 1U << (i % 32);
+	}
+	return paddr;
+}
+
+/*
+ * Try to take over every frame in the block of 2^ORDER frames at BASE.
+ */
+static
+bool
+compact_block(paddr_t base, unsigned order)
+{
+	uint32_t claimed[(1U << COREMAP_MAXORDER) / 32];
+	unsigned npages = 1U << order;
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr, to;
+	unsigned i;
+	bool moved;
+
+	bzero(claimed, sizeof(claimed));
+	for (i = 0; i < npages; i++) {
+		if (coremap_claim(base + i * PAGE_SIZE)) {
+			claimed[i / 32] |= 1U << (i % 32);
+		}
+	}
+
+	for (i = 0; i < npages; i++) {
+		if (claimed[i / 32] & (1U << (i % 32))) {
+			continue;
+		}
+		paddr = base + i * PAGE_SIZE;
+		if (!coremap_pin(paddr, &as, &vaddr)) {
+			//freed since we looked, cached text, or now in use by something we can't move
+			if (!coremap_claim(paddr) && !vm_reclaim(paddr)) {
+				break;
+			}
+			claimed[i / 32] |= 1U << (i % 32);
+			continue;
+		}
+
+		to = compact_target(base, npages, claimed);
+		moved = to != 0 && vm_migrate(as, vaddr, paddr, to);
+		coremap_unpin(paddr, moved);
+		if (!moved) {
+			if (to != 0) {
+				coremap_free(to);
+			}
+			break;
+		}
+		claimed[i / 32] |= 1U << (i % 32);
+		vmstats_inc(VMSTAT_COMPACT_MIGRATE);
+	}
+
+	if (i == npages) {
+		coremap_join(base, order);
+		return true;
+	}
+
+	//give it all back, straight to the buddy lists so it coalesces again
+	for (i = 0; i < npages; i++) {
+		if (claimed[i / 32] & (1U << (i % 32))) {
+			paddr = base + i * PAGE_SIZE;
+			coremap_free_batch(&paddr, 1);
+		}
+	}
+	return false;
+}
+
+paddr_t
+compact_alloc(unsigned long npages)
+{
+	unsigned order = 0;
+	unsigned tries;
+	paddr_t base = 0;
+
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (compact_lock == NULL || order > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	lock_acquire(compact_lock);
+	for (tries = 0; tries < COMPACT_TRIES; tries++) {
+		//somebody may have freed enough in the meantime
+		base = coremap_alloc(npages);
+		if (base != 0) {
+			break;
+		}
+		base = coremap_compact_pick(order);
+		if (base == 0) {
+			break;
+		}
+		if (compact_block(base, order)) {
+			vmstats_inc(VMSTAT_COMPACT_SUCCESS);
+			break;
+		}
+		base = 0;
+	}
+	if (base == 0) {
+		vmstats_inc(VMSTAT_COMPACT_FAIL);
+	}
+	lock_release(compact_lock);
+	return base;
+}
@@ -0,0 +1,971 @@
+/*
+ * Physical frame allocator.
+ *
+ * All of physical memory left over after boot is managed as a binary
+ * buddy system. Each frame has a coremap entry; the first frame of
+ * every block (free or allocated) records the block's order, and free
+ * blocks are kept on one doubly-linked list per order, threaded
+ * through the coremap entries by frame number. This means allocation
+ * never has to scan the coremap and free_kpages never has to walk an
+ * allocation to find out where it ends.
+ *
+ * Single frames, which are nearly all of the traffic, go through a
+ * small per-cpu magazine first. A magazine is refilled from and
+ * drained to the buddy lists FRAMEMAG_BATCH frames at a time, so most
+ * single-page allocations and frees never touch coremap_lock.
+ * Frames sitting in a magazine are allocated as far as the buddy
+ * lists are concerned.
+ *
+ * Allocated blocks carry a reference count so that copy-on-write can
+ * share a frame between address spaces; coremap_free only gives the
+ * block back when the last reference goes away.
+ *
+ * Frames holding user pages also record their owner (address space
+ * and virtual address) and a software reference bit, so that when
+ * memory runs out the VM system can pick a victim with the clock
+ * algorithm and page it out. A victim stays pinned until the VM system
+ * is done with it; freeing a pinned frame waits for that. The same
+ * pinning lets compaction move user pages out of the way when no free
+ * block is large enough.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <current.h>
+#include <cpu.h>
+#include <vm.h>
+#include <coremap.h>
+#include <platform/maxcpus.h>
+
+/* States of a coremap entry. */
+#define CME_TAIL   0	/* not the first frame of a block */
+#define CME_FREE   1	/* first frame of a free block */
+#define CME_INUSE  2	/* first frame of an allocated block */
+
+/* Flags in a coremap entry. */
+#define CMF_REFERENCED  0x01	/* user page used since the clock last passed */
+#define CMF_PINNED      0x02	/* user page is being evicted (or moved), or reserved */
+#define CMF_WSREF       0x04	/* user page used since the working-set sweep passed */
+#define CMF_CACHED      0x08	/* frame is in the text cache */
+
+/*
+ * One of these per frame, 12 bytes. Only the head of a free block is
+ * ever on a free list and only the head of an allocated one can have
+ * an owner, so the list links and the owner share space. The owner
+ * fields are only meaningful in CME_INUSE entries, and are cleared
+ * whenever a block is allocated.
+ *
+ * A frame number and a page-aligned user address both fit in 20 bits,
+ * which leaves room for the order, state and flags in the same word,
+ * and the refcount a whole word of its own: every mapping of a shared
+ * frame holds a reference, and a user program can make as many
+ * mappings as it has page table space for.
+ */
+struct coremap_entry {
+	union {
+		int32_t next;		/* free list link, -1 = none */
+		struct addrspace *as;	/* owner of a user page, or NULL */
+	} cme_u;
+	uint32_t cme_page : 20;	/* prev free frame, or owner's vaddr / PAGE_SIZE */
+	uint32_t cme_order : 4;	/* order of the block this frame heads */
+	uint32_t cme_state : 2;	/* CME_* above */
+	uint32_t cme_flags : 6;	/* CMF_* above */
+	uint32_t cme_refcount;	/* address spaces sharing an inuse block */
+};
+#define cme_next   cme_u.next	/* free list links */
+#define cme_prev   cme_page
+#define cme_as     cme_u.as	/* owner of a user page */
+#define cme_vpage  cme_page	/* where AS has it mapped */
+
+#define CME_NOFRAME  0xfffff	/* cme_prev of the first block on a list */
+
+static struct coremap_entry *coremap;
+static paddr_t firstframe;		/* physical address of frame 0 */
+static unsigned nframes;		/* number of frames managed */
+static unsigned nfreeframes;		/* number of those that are free */
+static int32_t freelists[COREMAP_MAXORDER + 1];
+static bool coremap_ready = false;
+static unsigned clockhand;		/* next frame the clock looks at */
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct wchan *coremap_wchan;	/* for waiting on pinned frames */
+
+/*
+ * Per-cpu magazines of free single frames, indexed by cpu number like
+ * cpustacks[]. Each has its own lock so that a cpu that finds the
+ * buddy lists empty can take back frames parked on other cpus; a
+ * thread that migrates between looking up its magazine and locking it
+ * just ends up using another cpu's magazine, which is harmless.
+ *
+ * Lock ordering: a magazine lock may be held while getting
+ * coremap_lock, never the other way round, and never two magazine
+ * locks at once.
+ */
+#define FRAMEMAG_SIZE   8
+#define FRAMEMAG_BATCH  4
+
+struct framemag {
+	struct spinlock fm_lock;
+	unsigned fm_count;
+	paddr_t fm_frames[FRAMEMAG_SIZE];
+};
+
+static struct framemag framemags[MAXCPUS];
+
+////////////////////////////////////////////////////////////
+//
+// Free list handling. Caller holds coremap_lock.
+
+static
+void
+freelist_push(unsigned frame, unsigned order)
+{
+	struct coremap_entry *e = &coremap[frame];
+
+	e->cme_state = CME_FREE;
+	e->cme_order = order;
+	e->cme_prev = CME_NOFRAME;
+	e->cme_next = freelists[order];
+	if (freelists[order] >= 0) {
+		coremap[freelists[order]].cme_prev = frame;
+	}
+	freelists[order] = frame;
+}
+
+static
+void
+freelist_remove(unsigned frame)
+{
+	struct coremap_entry *e = &coremap[frame];
+
+	KASSERT(e->cme_state == CME_FREE);
+
+	if (e->cme_prev != CME_NOFRAME) {
+		coremap[e->cme_prev].cme_next = e->cme_next;
+	}
+	else {
+		freelists[e->cme_order] = e->cme_next;
+	}
+	if (e->cme_next >= 0) {
+		coremap[e->cme_next].cme_prev = e->cme_prev;
+	}
+	e->cme_state = CME_TAIL;
+	e->cme_next = -1;
+	e->cme_prev = CME_NOFRAME;
+}
+
+/*
+ * Smallest order whose block holds NPAGES frames.
+ */
+static
+unsigned
+npages_to_order(unsigned long npages)
+{
+	unsigned order = 0;
+
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	return order;
+}
+
+////////////////////////////////////////////////////////////
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	unsigned maxframes, i, order;
+
+	/*
+	 * Size the coremap for everything ram_stealmem hasn't handed
+	 * out yet. kmalloc will itself steal the pages for the coremap,
+	 * so ask again afterwards to find where managed memory begins.
+	 */
+	COMPILE_ASSERT(sizeof(struct coremap_entry) == 12);
+	COMPILE_ASSERT(COREMAP_MAXORDER < 16);
+
+	ram_getsize(&lo, &hi);
+	maxframes = (hi - lo) / PAGE_SIZE;
+
+	coremap = kmalloc(sizeof(struct coremap_entry) * maxframes);
+	if (coremap == NULL) {
+		panic("coremap_bootstrap: no memory for the coremap\n");
+	}
+
+	ram_getsize(&lo, &hi);
+	firstframe = ROUNDUP(lo, PAGE_SIZE);
+	nframes = (hi - firstframe) / PAGE_SIZE;
+	KASSERT(nframes <= maxframes);
+	KASSERT(nframes < CME_NOFRAME);
+
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		freelists[i] = -1;
+	}
+	for (i = 0; i < MAXCPUS; i++) {
+		spinlock_init(&framemags[i].fm_lock);
+		framemags[i].fm_count = 0;
+	}
+	for (i = 0; i < nframes; i++) {
+		coremap[i].cme_next = -1;
+		coremap[i].cme_prev = CME_NOFRAME;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_state = CME_TAIL;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_flags = 0;
+	}
+
+	/*
+	 * Carve memory into the largest naturally aligned blocks that
+	 * fit. nframes is generally not a power of two, so the tail end
+	 * is made of progressively smaller blocks.
+	 */
+	nfreeframes = 0;
+	i = 0;
+	while (i < nframes) {
+		order = COREMAP_MAXORDER;
+		while (order > 0 &&
+		       ((i & ((1U << order) - 1)) != 0 ||
+			i + (1U << order) > nframes)) {
+			order--;
+		}
+		freelist_push(i, order);
+		nfreeframes += 1U << order;
+		i += 1U << order;
+	}
+
+	coremap_wchan = wchan_create("coremap");
+	if (coremap_wchan == NULL) {
+		panic("coremap_bootstrap: cannot create wchan\n");
+	}
+	clockhand = 0;
+
+	coremap_ready = true;
+
+	/* From here on ram_stealmem must not be used. */
+	switchTocoremap();
+}
+
+bool
+coremap_isready(void)
+{
+	return coremap_ready;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Buddy operations. Caller holds coremap_lock.
+
+/*
+ * Take a block of order WANT off the free lists, splitting a larger
+ * one if necessary. Returns the first frame number, or -1.
+ */
+static
+int32_t
+buddy_alloc(unsigned want)
+{
+	unsigned order;
+	unsigned frame;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (order = want; order <= COREMAP_MAXORDER; order++) {
+		if (freelists[order] >= 0) {
+			break;
+		}
+	}
+	if (order > COREMAP_MAXORDER) {
+		return -1;
+	}
+
+	frame = freelists[order];
+	freelist_remove(frame);
+
+	/* Split off and free the upper halves until the block fits. */
+	while (order > want) {
+		order--;
+		freelist_push(frame + (1U << order), order);
+	}
+
+	coremap[frame].cme_state = CME_INUSE;
+	coremap[frame].cme_order = want;
+	coremap[frame].cme_refcount = 1;
+	coremap[frame].cme_flags = 0;
+	coremap[frame].cme_as = NULL;
+	coremap[frame].cme_vpage = 0;
+	nfreeframes -= 1U << want;
+
+	return frame;
+}
+
+static
+void
+buddy_free(unsigned frame)
+{
+	unsigned buddy, order;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(frame < nframes);
+
+	if (coremap[frame].cme_state != CME_INUSE) {
+		panic("coremap_free: frame 0x%x is not allocated\n",
+		      firstframe + frame * PAGE_SIZE);
+	}
+	order = coremap[frame].cme_order;
+	coremap[frame].cme_state = CME_TAIL;
+	coremap[frame].cme_refcount = 0;
+	nfreeframes += 1U << order;
+
+	/* Merge with the buddy for as long as the buddy is free too. */
+	while (order < COREMAP_MAXORDER) {
+		buddy = frame ^ (1U << order);
+		if (buddy + (1U << order) > nframes) {
+			break;
+		}
+		if (coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		frame &= ~(1U << order);
+		order++;
+	}
+	freelist_push(frame, order);
+}
+
+static
+unsigned
+paddr_to_frame(paddr_t paddr)
+{
+	unsigned frame;
+
+	KASSERT((paddr & ~(paddr_t)PAGE_FRAME) == 0);
+	KASSERT(paddr >= firstframe);
+	frame = (paddr - firstframe) / PAGE_SIZE;
+	KASSERT(frame < nframes);
+	return frame;
+}
+
+/*
+ * Forget the owner of a user page about to be freed, first waiting
+ * for any eviction that has it pinned to finish. Called and returns
+ * with coremap_lock held, but may sleep in between.
+ */
+static
+void
+coremap_disown(unsigned frame)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	while (coremap[frame].cme_flags & CMF_PINNED) {
+		wchan_lock(coremap_wchan);
+		spinlock_release(&coremap_lock);
+		wchan_sleep(coremap_wchan);
+		spinlock_acquire(&coremap_lock);
+	}
+	coremap[frame].cme_as = NULL;
+	coremap[frame].cme_vpage = 0;
+	coremap[frame].cme_flags &= ~(CMF_REFERENCED | CMF_WSREF);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Magazines.
+
+static
+struct framemag *
+framemag_mine(void)
+{
+	return &framemags[curcpu->c_number];
+}
+
+/*
+ * Move up to FRAMEMAG_BATCH frames from the buddy lists into MAG.
+ * Caller holds the magazine lock.
+ */
+static
+void
+framemag_refill(struct framemag *mag)
+{
+	int32_t frame;
+
+	KASSERT(spinlock_do_i_hold(&mag->fm_lock));
+
+	spinlock_acquire(&coremap_lock);
+	while (mag->fm_count < FRAMEMAG_BATCH) {
+		frame = buddy_alloc(0);
+		if (frame < 0) {
+			break;
+		}
+		mag->fm_frames[mag->fm_count++] = firstframe + frame * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return up to NUM frames from MAG to the buddy lists.
+ * Caller holds the magazine lock.
+ */
+static
+void
+framemag_drain(struct framemag *mag, unsigned num)
+{
+	KASSERT(spinlock_do_i_hold(&mag->fm_lock));
+
+	spinlock_acquire(&coremap_lock);
+	while (num > 0 && mag->fm_count > 0) {
+		buddy_free(paddr_to_frame(mag->fm_frames[--mag->fm_count]));
+		num--;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Empty every cpu's magazine back into the buddy lists. Used when the
+ * buddy lists come up short, so that frames parked elsewhere (or
+ * fragmenting a larger block) are not mistaken for a real shortage.
+ */
+static
+void
+framemag_drain_all(void)
+{
+	unsigned i;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		spinlock_acquire(&framemags[i].fm_lock);
+		framemag_drain(&framemags[i], FRAMEMAG_SIZE);
+		spinlock_release(&framemags[i].fm_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface.
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	struct framemag *mag;
+	unsigned order;
+	int32_t frame;
+	paddr_t paddr = 0;
+
+	KASSERT(npages > 0);
+
+	order = npages_to_order(npages);
+	if (order > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	if (order == 0) {
+		mag = framemag_mine();
+		spinlock_acquire(&mag->fm_lock);
+		if (mag->fm_count == 0) {
+			framemag_refill(mag);
+		}
+		if (mag->fm_count > 0) {
+			paddr = mag->fm_frames[--mag->fm_count];
+		}
+		spinlock_release(&mag->fm_lock);
+		if (paddr != 0) {
+			return paddr;
+		}
+	}
+
+	spinlock_acquire(&coremap_lock);
+	frame = buddy_alloc(order);
+	spinlock_release(&coremap_lock);
+
+	if (frame < 0) {
+		framemag_drain_all();
+		spinlock_acquire(&coremap_lock);
+		frame = buddy_alloc(order);
+		spinlock_release(&coremap_lock);
+		if (frame < 0) {
+			return 0;
+		}
+	}
+
+	return firstframe + frame * PAGE_SIZE;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	struct framemag *mag;
+	unsigned frame;
+
+	if (paddr < firstframe) {
+		/* Stolen with ram_stealmem before we existed; leak it. */
+		return;
+	}
+	frame = paddr_to_frame(paddr);
+
+	/*
+	 * A count of one can only be changed by us, its sole holder, so
+	 * the unlocked check is safe; anything higher has to be dropped
+	 * under the lock, and may turn out to have fallen to one by then.
+	 */
+	if (coremap[frame].cme_refcount > 1) {
+		spinlock_acquire(&coremap_lock);
+		if (coremap[frame].cme_refcount > 1) {
+			coremap[frame].cme_refcount--;
+			spinlock_release(&coremap_lock);
+			return;
+		}
+		spinlock_release(&coremap_lock);
+	}
+
+	//pinned with no owner is reserved, and never to be freed
+	KASSERT((coremap[frame].cme_flags & CMF_PINNED) == 0 ||
+		coremap[frame].cme_as != NULL);
+	if (coremap[frame].cme_as != NULL) {
+		spinlock_acquire(&coremap_lock);
+		coremap_disown(frame);
+		spinlock_release(&coremap_lock);
+	}
+
+	/*
+	 * The caller owns the block, so its order can't change under
+	 * us and is safe to look at without the lock.
+	 */
+	if (coremap[frame].cme_state == CME_INUSE &&
+	    coremap[frame].cme_order == 0) {
+		mag = framemag_mine();
+		spinlock_acquire(&mag->fm_lock);
+		if (mag->fm_count == FRAMEMAG_SIZE) {
+			framemag_drain(mag, FRAMEMAG_BATCH);
+		}
+		mag->fm_frames[mag->fm_count++] = paddr;
+		spinlock_release(&mag->fm_lock);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	buddy_free(frame);
+	spinlock_release(&coremap_lock);
+}
+
+int
+coremap_alloc_batch(unsigned npages, paddr_t *frames)
+{
+	unsigned i;
+	int32_t frame;
+	bool drained = false;
+
+ retry:
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < npages; i++) {
+		frame = buddy_alloc(0);
+		if (frame < 0) {
+			break;
+		}
+		frames[i] = firstframe + frame * PAGE_SIZE;
+	}
+	if (i < npages) {
+		/* All or nothing: put back what we got. */
+		while (i > 0) {
+			i--;
+			buddy_free(paddr_to_frame(frames[i]));
+		}
+		spinlock_release(&coremap_lock);
+		if (!drained) {
+			framemag_drain_all();
+			drained = true;
+			goto retry;
+		}
+		return ENOMEM;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+void
+coremap_free_batch(const paddr_t *frames, unsigned npages)
+{
+	unsigned i, frame;
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < npages; i++) {
+		if (frames[i] < firstframe) {
+			continue;
+		}
+		frame = paddr_to_frame(frames[i]);
+		if (coremap[frame].cme_refcount > 1) {
+			coremap[frame].cme_refcount--;
+			continue;
+		}
+		if (coremap[frame].cme_as != NULL) {
+			coremap_disown(frame);
+		}
+		buddy_free(frame);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	unsigned frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_state == CME_INUSE);
+	coremap[frame].cme_refcount++;
+	/*
+	 * Shared frames have no single owner to evict them from. An
+	 * eviction that already has this one pinned will see the new
+	 * count and back off.
+	 */
+	coremap[frame].cme_as = NULL;
+	coremap[frame].cme_vpage = 0;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Only meaningful to a holder of a reference: the count can't drop
+ * below the caller's own, and a result of one means it is the only one.
+ */
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	return coremap[paddr_to_frame(paddr)].cme_refcount;
+}
+
+void
+coremap_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_state == CME_INUSE);
+	KASSERT(coremap[frame].cme_order == 0);
+	coremap[frame].cme_as = as;
+	coremap[frame].cme_vpage = vaddr / PAGE_SIZE;
+	coremap[frame].cme_flags |= CMF_REFERENCED | CMF_WSREF;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_set_cached(paddr_t paddr, bool cached)
+{
+	unsigned frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_state == CME_INUSE);
+	if (cached) {
+		coremap[frame].cme_flags |= CMF_CACHED;
+	}
+	else {
+		coremap[frame].cme_flags &= ~CMF_CACHED;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_reserve(paddr_t paddr)
+{
+	unsigned frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_state == CME_INUSE);
+	KASSERT(coremap[frame].cme_as == NULL);
+	coremap[frame].cme_flags |= CMF_PINNED;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Under the lock like every other update: the flags share a word with
+ * the order, state and page number, so an unlocked write could undo a
+ * racing change to any of them.
+ */
+void
+coremap_touch(paddr_t paddr)
+{
+	unsigned frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	coremap[frame].cme_flags |= CMF_REFERENCED | CMF_WSREF;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_sample_ref(paddr_t paddr)
+{
+	struct coremap_entry *e = &coremap[paddr_to_frame(paddr)];
+	bool referenced;
+
+	spinlock_acquire(&coremap_lock);
+	referenced = (e->cme_flags & CMF_WSREF) != 0;
+	e->cme_flags &= ~CMF_WSREF;
+	spinlock_release(&coremap_lock);
+	return referenced;
+}
+
+/*
+ * Whether frame E is a user page that can be taken away from its
+ * owner: a single frame, not shared, not already pinned.
+ */
+static
+bool
+coremap_pinnable(const struct coremap_entry *e)
+{
+	return e->cme_state == CME_INUSE && e->cme_order == 0 &&
+		e->cme_as != NULL && e->cme_refcount == 1 &&
+		(e->cme_flags & CMF_PINNED) == 0;
+}
+
+/*
+ * Move the clock hand on to the next user page that could be evicted,
+ * passing over shared and already pinned frames, and hand it back with
+ * its reference bit (which is cleared). The caller decides whether a
+ * referenced page gets a second chance, since it may also have to
+ * arrange to hear about the next reference. A full turn without a
+ * candidate means there is nothing to evict.
+ */
+paddr_t
+coremap_pick_victim(struct addrspace **as, vaddr_t *vaddr, bool *referenced)
+{
+	struct coremap_entry *e;
+	unsigned n, frame;
+
+	spinlock_acquire(&coremap_lock);
+	for (n = 0; n < nframes; n++) {
+		frame = clockhand;
+		clockhand = (clockhand + 1) % nframes;
+		e = &coremap[frame];
+
+		if (!coremap_pinnable(e)) {
+			continue;
+		}
+
+		e->cme_flags |= CMF_PINNED;
+		*as = e->cme_as;
+		*vaddr = (vaddr_t)e->cme_vpage * PAGE_SIZE;
+		*referenced = (e->cme_flags & CMF_REFERENCED) != 0;
+		e->cme_flags &= ~CMF_REFERENCED;
+		spinlock_release(&coremap_lock);
+		return firstframe + frame * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+paddr_t
+coremap_pin_next(unsigned *cursor, struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *e;
+	unsigned frame;
+
+	spinlock_acquire(&coremap_lock);
+	for (frame = *cursor; frame < nframes; frame++) {
+		e = &coremap[frame];
+		if (!coremap_pinnable(e)) {
+			continue;
+		}
+		e->cme_flags |= CMF_PINNED;
+		*as = e->cme_as;
+		*vaddr = (vaddr_t)e->cme_vpage * PAGE_SIZE;
+		*cursor = frame + 1;
+		spinlock_release(&coremap_lock);
+		return firstframe + frame * PAGE_SIZE;
+	}
+	*cursor = 0;
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+bool
+coremap_pin(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *e = &coremap[paddr_to_frame(paddr)];
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_pinnable(e)) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	e->cme_flags |= CMF_PINNED;
+	*as = e->cme_as;
+	*vaddr = (vaddr_t)e->cme_vpage * PAGE_SIZE;
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+void
+coremap_unpin(paddr_t paddr, bool disown)
+{
+	unsigned frame = paddr_to_frame(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_flags & CMF_PINNED);
+	coremap[frame].cme_flags &= ~CMF_PINNED;
+	if (disown) {
+		coremap[frame].cme_as = NULL;
+		coremap[frame].cme_vpage = 0;
+		coremap[frame].cme_flags &= ~(CMF_REFERENCED | CMF_WSREF);
+	}
+	spinlock_release(&coremap_lock);
+
+	wchan_wakeall(coremap_wchan);
+}
+
+/*
+ * Whether the block of 2^ORDER frames at BASE could be emptied:
+ * every frame is free, a user page that could be moved, or a text
+ * cache frame that could be reclaimed. Sets *MOVES to the number of
+ * the latter two. Caller holds coremap_lock.
+ */
+static
+bool
+coremap_compactable(unsigned base, unsigned order, unsigned *moves)
+{
+	struct coremap_entry *e;
+	unsigned frame;
+
+	*moves = 0;
+	for (frame = base; frame < base + (1U << order); ) {
+		e = &coremap[frame];
+		if (e->cme_state == CME_FREE) {
+			frame += 1U << e->cme_order;
+		}
+		else if (coremap_pinnable(e) || (e->cme_flags & CMF_CACHED)) {
+			(*moves)++;
+			frame++;
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
+
+paddr_t
+coremap_compact_pick(unsigned order)
+{
+	unsigned base, moves, best = 0, bestmoves = ~0U;
+
+	KASSERT(order <= COREMAP_MAXORDER);
+
+	/* Frames parked in magazines would look like kernel pages. */
+	framemag_drain_all();
+
+	spinlock_acquire(&coremap_lock);
+	for (base = 0; base + (1U << order) <= nframes && bestmoves > 0;
+	     base += 1U << order) {
+		if (coremap_compactable(base, order, &moves) &&
+		    moves < bestmoves) {
+			best = base;
+			bestmoves = moves;
+		}
+	}
+	spinlock_release(&coremap_lock);
+
+	return bestmoves == ~0U ? 0 : firstframe + best * PAGE_SIZE;
+}
+
+bool
+coremap_claim(paddr_t paddr)
+{
+	unsigned frame = paddr_to_frame(paddr);
+	unsigned head, order;
+
+	spinlock_acquire(&coremap_lock);
+	/* The free block holding FRAME starts at FRAME rounded down to its size. */
+	for (order = 0; order <= COREMAP_MAXORDER; order++) {
+		head = frame & ~((1U << order) - 1);
+		if (coremap[head].cme_state == CME_FREE &&
+		    coremap[head].cme_order == order) {
+			break;
+		}
+	}
+	if (order > COREMAP_MAXORDER) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+
+	/* Split it down, freeing the halves FRAME isn't in. */
+	freelist_remove(head);
+	while (order > 0) {
+		order--;
+		if (frame >= head + (1U << order)) {
+			freelist_push(head, order);
+			head += 1U << order;
+		}
+		else {
+			freelist_push(head + (1U << order), order);
+		}
+	}
+
+	coremap[frame].cme_state = CME_INUSE;
+	coremap[frame].cme_order = 0;
+	coremap[frame].cme_refcount = 1;
+	coremap[frame].cme_flags = 0;
+	coremap[frame].cme_as = NULL;
+	coremap[frame].cme_vpage = 0;
+	nfreeframes--;
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+void
+coremap_join(paddr_t paddr, unsigned order)
+{
+	unsigned base = paddr_to_frame(paddr);
+	unsigned frame;
+
+	KASSERT((base & ((1U << order) - 1)) == 0);
+
+	spinlock_acquire(&coremap_lock);
+	for (frame = base; frame < base + (1U << order); frame++) {
+		KASSERT(coremap[frame].cme_state == CME_INUSE);
+		KASSERT(coremap[frame].cme_order == 0);
+		KASSERT(coremap[frame].cme_refcount == 1);
+		KASSERT(coremap[frame].cme_as == NULL);
+		if (frame != base) {
+			coremap[frame].cme_state = CME_TAIL;
+			coremap[frame].cme_refcount = 0;
+		}
+	}
+	coremap[base].cme_order = order;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_stats(unsigned *total, unsigned *nfree)
+{
+	unsigned i, inmags = 0;
+
+	/* The magazine counts are only a snapshot; that's good enough. */
+	for (i = 0; i < MAXCPUS; i++) {
+		inmags += framemags[i].fm_count;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	*total = nframes;
+	*nfree = nfreeframes + inmags;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Print the free lists. Done without the lock because kprintf may
+ * sleep, so the output is only a snapshot.
+ */
+void
+coremap_dump(void)
+{
+	unsigned order, count;
+	int32_t frame;
+
+	kprintf("coremap: %u frames, %u free\n", nframes, nfreeframes);
+	for (order = 0; order <= COREMAP_MAXORDER; order++) {
+		count = 0;
+		for (frame = freelists[order]; frame >= 0;
+		     frame = coremap[frame].cme_next) {
+			count++;
+		}
+		kprintf("coremap: order %2u: %u free blocks\n", order, count);
+	}
+}
@@ -31,6 +31,7 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include "opt-A3.h"
 
 /*
  * Kernel malloc.
@@ -107,6 +108,9 @@ struct pageref {
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
+#if OPT_A3
+	struct pageref *next_hash;
+#endif
 };
 
 #define INVALID_OFFSET   (0xffff)
@@ -117,6 +121,101 @@ struct pageref {
 
 ////////////////////////////////////////
 
+#if OPT_A3
+/*
+ * Pagerefs come in pages of them, chained together. The first page is
+ * in the kernel BSS, so kmalloc works before the VM system does; more
+ * are got from alloc_kpages as the heap grows, so the subpage heap can
+ * use as much of memory as there is. Free pagerefs are kept on a list
+ * (through next_samesize, which a free one has no use for), so getting
+ * one doesn't mean searching for it. Pages of pagerefs are never given
+ * back, but they're only 1/200th or so of the heap they describe.
+ */
+
+struct pagerefpage {
+	struct pagerefpage *next;
+	struct pageref refs[];
+};
+
+#define NPAGEREFS \
+	((PAGE_SIZE - sizeof(struct pagerefpage)) / sizeof(struct pageref))
+
+static uint32_t pagerefpage0[PAGE_SIZE / sizeof(uint32_t)];
+
+static struct pagerefpage *pagerefpages;	/* the chain of pages */
+static struct pageref *pagerefs_free;		/* free ones */
+static unsigned pagerefs_total;			/* in all the pages */
+
+/*
+ * Put the page of pagerefs at PAGE in the pool.
+ */
+static
+void
+addpagerefs(vaddr_t page)
+{
+	struct pagerefpage *prp = (struct pagerefpage *)page;
+	unsigned i;
+
+	prp->next = pagerefpages;
+	pagerefpages = prp;
+	for (i=0; i<NPAGEREFS; i++) {
+		prp->refs[i].next_samesize = pagerefs_free;
+		pagerefs_free = &prp->refs[i];
+	}
+	pagerefs_total += NPAGEREFS;
+}
+
+/*
+ * Returns NULL when the pool is used up, in which case the caller
+ * should get another page for addpagerefs.
+ */
+static
+struct pageref *
+allocpageref(void)
+{
+	struct pageref *pr;
+
+	if (pagerefpages == NULL) {
+		addpagerefs((vaddr_t)pagerefpage0);
+	}
+
+	pr = pagerefs_free;
+	if (pr == NULL) {
+		/* ran out */
+		return NULL;
+	}
+	pagerefs_free = pr->next_samesize;
+	return pr;
+}
+
+static
+void
+freepageref(struct pageref *p)
+{
+#ifdef SLOW
+	struct pagerefpage *prp;
+
+	for (prp = pagerefpages; prp != NULL; prp = prp->next) {
+		if (p >= prp->refs && p < prp->refs + NPAGEREFS) {
+			break;
+		}
+	}
+	KASSERT(prp != NULL);
+#endif
+	p->next_samesize = pagerefs_free;
+	pagerefs_free = p;
+}
+
+/*
+ * The pagerefs in use, hashed by page address (chained through
+ * next_hash), so kfree can find the page a pointer is on without going
+ * through all of them.
+ */
+#define PRHASH_SIZE 256
+#define PRHASH(va) (((va) / PAGE_SIZE) % PRHASH_SIZE)
+static struct pageref *prhash[PRHASH_SIZE];
+
+#else
 /*
  * This is cheesy. 
  *
@@ -181,6 +280,8 @@ freepageref(struct pageref *p)
 	pagerefs_inuse[i] &= ~k;
 }
 
+#endif /* OPT_A3 */
+
 ////////////////////////////////////////
 
 static struct pageref *sizebases[NSIZES];
@@ -260,14 +361,22 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
+#if OPT_A3
+			KASSERT(sc < pagerefs_total);
+#else
 			KASSERT(sc < NPAGEREFS);
+#endif
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
+#if OPT_A3
+		KASSERT(ac < pagerefs_total);
+#else
 		KASSERT(ac < NPAGEREFS);
+#endif
 		ac++;
 	}
 
@@ -339,6 +448,10 @@ kheap_printstats(void)
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
+#if OPT_A3
+	kprintf("%u pagerefs in %u pages\n", pagerefs_total,
+		pagerefs_total / (unsigned)NPAGEREFS);
+#endif
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		dumpsubpage(pr);
@@ -372,6 +485,15 @@ remove_lists(struct pageref *pr, int blktype)
 			break;
 		}
 	}
+
+#if OPT_A3
+	for (guy = &prhash[PRHASH(PR_PAGEADDR(pr))]; *guy; guy = &(*guy)->next_hash) {
+		if (*guy == pr) {
+			*guy = pr->next_hash;
+			break;
+		}
+	}
+#endif
 }
 
 static
@@ -469,6 +591,21 @@ subpage_kmalloc(size_t sz)
 	spinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
+#if OPT_A3
+	if (pr==NULL) {
+		/* Out of pagerefs: get another page of them, again unlocked. */
+		vaddr_t refpage;
+
+		spinlock_release(&kmalloc_spinlock);
+		refpage = alloc_kpages(1);
+		spinlock_acquire(&kmalloc_spinlock);
+		if (refpage != 0) {
+			addpagerefs(refpage);
+		}
+		/* from our page, or one added while we had let go of the lock */
+		pr = allocpageref();
+	}
+#endif
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
 		spinlock_release(&kmalloc_spinlock);
@@ -504,6 +641,11 @@ subpage_kmalloc(size_t sz)
 	pr->next_all = allbase;
 	allbase = pr;
 
+#if OPT_A3
+	pr->next_hash = prhash[PRHASH(prpage)];
+	prhash[PRHASH(prpage)] = pr;
+#endif
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
@@ -526,7 +668,11 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
+#if OPT_A3
+	for (pr = prhash[PRHASH(ptraddr)]; pr; pr = pr->next_hash) {
+#else
 	for (pr = allbase; pr; pr = pr->next_all) {
+#endif
 		prpage = PR_PAGEADDR(pr);
 		blktype = PR_BLOCKTYPE(pr);
 
@@ -0,0 +1,258 @@
+/*
+ * Same-page merging scanner.
+ *
+ * Each second the scanner looks at up to ksm_rate user pages, in
+ * coremap order, that have a single owner. A page is hashed and then:
+ *
+ *  - if a frame that's already been merged into (a "stable" frame)
+ *    has the same contents, the page is merged into it;
+ *  - else if a page seen earlier in this pass (an "unstable" one) has
+ *    the same contents, that page's frame becomes stable and this page
+ *    is merged into it;
+ *  - else it's remembered as unstable for the rest of the pass.
+ *
+ * Unstable pages are only remembered by frame and hash, and pinned
+ * again (which fails if they've been freed, shared or evicted since)
+ * before they're used. Their contents can change at any time, so the
+ * hash is only a hint; vm_ksm_merge compares the real thing once the
+ * page can no longer be written. Stable frames are copy-on-write
+ * everywhere, so their contents stay put. The scanner holds a
+ * reference to each, and drops it at the end of a pass once nobody
+ * else maps the frame any more.
+ *
+ * Only the scanner thread touches the tables, so they need no lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <uw-vmstats.h>
+#include <ksm.h>
+
+#define KSM_BUCKETS  64		/* stable table hash buckets */
+#define KSM_UNSTABLE 256	/* unstable table slots (one page each) */
+
+struct ksm_stable {
+	uint32_t ks_hash;
+	paddr_t ks_paddr;
+	unsigned ks_sharers;	/* mappings last time we looked */
+	struct ksm_stable *ks_next;
+};
+
+struct ksm_unstable {
+	uint32_t ku_hash;
+	paddr_t ku_paddr;	/* 0 if the slot is empty */
+};
+
+static struct ksm_stable *ksm_stable[KSM_BUCKETS];
+static struct ksm_unstable ksm_unstable[KSM_UNSTABLE];
+static unsigned ksm_cursor;	/* next frame to look at */
+
+static struct spinlock ksm_lock = SPINLOCK_INITIALIZER;
+static unsigned ksm_rate;	/* pages per second, 0 to stop */
+static bool ksm_running;	/* the scanner thread exists */
+
+static
+uint32_t
+ksm_hash(paddr_t paddr)
+{
+	const uint32_t *words = (const uint32_t *)PADDR_TO_KVADDR(paddr);
+	uint32_t hash = 0;
+
+	for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		hash = hash * 31 + words[i];
+	}
+	return hash;
+}
+
+static
+bool
+ksm_same(paddr_t a, paddr_t b)
+{
+	return memcmp((const void *)PADDR_TO_KVADDR(a),
+		      (const void *)PADDR_TO_KVADDR(b), PAGE_SIZE) == 0;
+}
+
+/*
+ * Merge the page at VADDR in AS, in pinned frame PADDR, into stable
+ * frame KS. Unpins PADDR either way.
+ */
+static
+void
+ksm_merge(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	  struct ksm_stable *ks)
+{
+	bool merged;
+
+	merged = vm_ksm_merge(as, vaddr, paddr, ks->ks_paddr);
+	coremap_unpin(paddr, merged);
+	if (merged) {
+		coremap_free(paddr);
+		ks->ks_sharers++;
+		vmstats_inc(VMSTAT_KSM_MERGED);
+	}
+}
+
+/*
+ * Look at one page, pinned in frame PADDR.
+ */
+static
+void
+ksm_scan_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	struct ksm_stable *ks;
+	struct ksm_unstable *ku;
+	struct addrspace *uas;
+	vaddr_t uvaddr;
+	uint32_t hash;
+
+	vmstats_inc(VMSTAT_KSM_SCANNED);
+	hash = ksm_hash(paddr);
+
+	for (ks = ksm_stable[hash % KSM_BUCKETS]; ks != NULL; ks = ks->ks_next) {
+		if (ks->ks_hash == hash && ksm_same(ks->ks_paddr, paddr)) {
+			ksm_merge(as, vaddr, paddr, ks);
+			return;
+		}
+	}
+
+	ku = &ksm_unstable[hash % KSM_UNSTABLE];
+	if (ku->ku_paddr != 0 && ku->ku_paddr != paddr && ku->ku_hash == hash &&
+	    coremap_pin(ku->ku_paddr, &uas, &uvaddr)) {
+		ks = NULL;
+		if (ksm_same(ku->ku_paddr, paddr)) {
+			ks = kmalloc(sizeof(struct ksm_stable));
+		}
+		if (ks != NULL && vm_ksm_share(uas, uvaddr, ku->ku_paddr)) {
+			coremap_unpin(ku->ku_paddr, false);
+			ks->ks_hash = hash;
+			ks->ks_paddr = ku->ku_paddr;
+			ks->ks_sharers = 1;
+			ks->ks_next = ksm_stable[hash % KSM_BUCKETS];
+			ksm_stable[hash % KSM_BUCKETS] = ks;
+			ku->ku_paddr = 0;
+			ksm_merge(as, vaddr, paddr, ks);
+			return;
+		}
+		coremap_unpin(ku->ku_paddr, false);
+		kfree(ks);
+	}
+
+	ku->ku_hash = hash;
+	ku->ku_paddr = paddr;
+	coremap_unpin(paddr, false);
+}
+
+/*
+ * End of a pass: forget the unstable pages, and count how many
+ * mappings of stable frames have gone away (written to, or their
+ * process gone) since last time. Frames only the scanner still holds
+ * are let go, all of them if EVERYTHING.
+ */
+static
+void
+ksm_end_pass(bool everything)
+{
+	struct ksm_stable *ks, **p;
+	unsigned sharers;
+
+	bzero(ksm_unstable, sizeof(ksm_unstable));
+
+	for (unsigned b = 0; b < KSM_BUCKETS; b++) {
+		p = &ksm_stable[b];
+		while ((ks = *p) != NULL) {
+			sharers = coremap_refcount(ks->ks_paddr) - 1;
+			if (ks->ks_sharers > sharers) {
+				vmstats_add(VMSTAT_KSM_UNMERGED, ks->ks_sharers - sharers);
+			}
+			/*
+			 * The count can also have gone up without a merge, when
+			 * a process holding the frame forked. Start from the
+			 * real number either way, so that those mappings are
+			 * counted as unmerged when they go rather than being
+			 * netted off against later losses.
+			 */
+			ks->ks_sharers = sharers;
+
+			if (sharers == 0 || everything) {
+				*p = ks->ks_next;
+				coremap_free(ks->ks_paddr);
+				kfree(ks);
+				continue;
+			}
+			p = &ks->ks_next;
+		}
+	}
+}
+
+static
+void
+ksm_thread(void *data1, unsigned long data2)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	unsigned rate;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&ksm_lock);
+		rate = ksm_rate;
+		spinlock_release(&ksm_lock);
+		if (rate == 0) {
+			ksm_end_pass(true);
+			spinlock_acquire(&ksm_lock);
+			if (ksm_rate == 0) {
+				ksm_running = false;
+				spinlock_release(&ksm_lock);
+				break;
+			}
+			spinlock_release(&ksm_lock);
+			continue;
+		}
+
+		for (unsigned n = 0; n < rate; n++) {
+			paddr = coremap_pin_next(&ksm_cursor, &as, &vaddr);
+			if (paddr == 0) {
+				ksm_end_pass(false);
+				break;
+			}
+			ksm_scan_page(as, vaddr, paddr);
+		}
+		clocksleep(1);
+	}
+	thread_exit();
+}
+
+int
+ksm_setrate(unsigned rate)
+{
+	bool start;
+	int result;
+
+	spinlock_acquire(&ksm_lock);
+	ksm_rate = rate;
+	start = rate > 0 && !ksm_running;
+	if (start) {
+		ksm_running = true;
+	}
+	spinlock_release(&ksm_lock);
+
+	if (start) {
+		result = thread_fork("ksm", NULL, ksm_thread, NULL, 0);
+		if (result) {
+			spinlock_acquire(&ksm_lock);
+			ksm_running = false;
+			spinlock_release(&ksm_lock);
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Page-out daemon.
+ *
+ * The daemon sleeps on pageout_wchan until pageout_check sees free
+ * memory below pageout_low, then evicts pages one at a time until
+ * there are pageout_high free frames. If it runs out of things to
+ * evict (or of swap) it backs off for a second before it can be woken
+ * again, rather than being woken straight back up by the next
+ * allocation.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pageout.h>
+#include <uw-vmstats.h>
+
+static struct spinlock pageout_lock = SPINLOCK_INITIALIZER;
+static struct wchan *pageout_wchan;
+static bool pageout_wanted;	/* woken and not yet started */
+static unsigned pageout_low;	/* 0 until bootstrapped */
+static unsigned pageout_high;
+
+/* For pageout_printstats; updated only by the daemon */
+static unsigned pageout_wakeups;
+static unsigned pageout_reclaimed;
+static unsigned pageout_clean;
+static time_t pageout_start;
+
+static
+void
+pageout_thread(void *data1, unsigned long data2)
+{
+	unsigned total, nfree, high;
+	bool clean;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&pageout_lock);
+		while (!pageout_wanted) {
+			wchan_lock(pageout_wchan);
+			spinlock_release(&pageout_lock);
+			wchan_sleep(pageout_wchan);
+			spinlock_acquire(&pageout_lock);
+		}
+		high = pageout_high;
+		spinlock_release(&pageout_lock);
+		pageout_wakeups++;
+
+		coremap_stats(&total, &nfree);
+		while (nfree < high) {
+			if (!vm_pageout(&clean)) {
+				clocksleep(1);
+				break;
+			}
+			pageout_reclaimed++;
+			if (clean) {
+				pageout_clean++;
+			}
+			vmstats_inc(VMSTAT_PAGEOUT);
+			coremap_stats(&total, &nfree);
+		}
+
+		spinlock_acquire(&pageout_lock);
+		pageout_wanted = false;
+		spinlock_release(&pageout_lock);
+	}
+}
+
+void
+pageout_bootstrap(void)
+{
+	unsigned total, nfree;
+	uint32_t nsecs;
+	int result;
+
+	coremap_stats(&total, &nfree);
+	pageout_wchan = wchan_create("pageout");
+	if (pageout_wchan == NULL) {
+		panic("pageout_bootstrap: out of memory\n");
+	}
+	gettime(&pageout_start, &nsecs);
+
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		panic("pageout_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+
+	spinlock_acquire(&pageout_lock);
+	pageout_low = total / PAGEOUT_LOWDIV;
+	pageout_high = total / PAGEOUT_HIGHDIV;
+	spinlock_release(&pageout_lock);
+}
+
+void
+pageout_check(void)
+{
+	unsigned total, nfree;
+	bool wake = false;
+
+	coremap_stats(&total, &nfree);
+
+	spinlock_acquire(&pageout_lock);
+	if (nfree < pageout_low && !pageout_wanted) {
+		pageout_wanted = true;
+		wake = true;
+	}
+	spinlock_release(&pageout_lock);
+
+	if (wake) {
+		wchan_wakeone(pageout_wchan);
+	}
+}
+
+bool
+pageout_short(void)
+{
+	unsigned total, nfree;
+	bool isshort;
+
+	coremap_stats(&total, &nfree);
+
+	spinlock_acquire(&pageout_lock);
+	isshort = nfree < pageout_low;
+	spinlock_release(&pageout_lock);
+	return isshort;
+}
+
+int
+pageout_setwater(unsigned low, unsigned high)
+{
+	unsigned total, nfree;
+
+	coremap_stats(&total, &nfree);
+	if (low > high || high > total) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&pageout_lock);
+	pageout_low = low;
+	pageout_high = high;
+	spinlock_release(&pageout_lock);
+	return 0;
+}
+
+void
+pageout_printstats(void)
+{
+	unsigned total, nfree, low, high, secs;
+	time_t now;
+	uint32_t nsecs;
+
+	coremap_stats(&total, &nfree);
+	spinlock_acquire(&pageout_lock);
+	low = pageout_low;
+	high = pageout_high;
+	spinlock_release(&pageout_lock);
+
+	gettime(&now, &nsecs);
+	secs = now > pageout_start ? now - pageout_start : 1;
+
+	kprintf("pageout: %u/%u frames free, watermarks %u low %u high\n",
+		nfree, total, low, high);
+	kprintf("pageout: woken %u times, reclaimed %u frames (%u clean) "
+		"in %u seconds\n", pageout_wakeups, pageout_reclaimed,
+		pageout_clean, secs);
+	kprintf("pageout: %u frames/sec, %u clean frames/sec\n",
+		pageout_reclaimed / secs, pageout_clean / secs);
+}
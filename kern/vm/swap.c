@@ -0,0 +1,192 @@
+/*
+ * Swap space on a raw disk.
+ *
+ * Slot N occupies bytes [N*PAGE_SIZE, (N+1)*PAGE_SIZE) of the device,
+ * though its contents may only ever live in the compressed swap cache.
+ * The slot bitmap and reference counts are protected by a spinlock; the
+ * I/O itself is serialized by the disk driver. The counts are full
+ * words, since every fork of a process with pages in swap adds to them.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+#include <zswap.h>
+#include <uw-vmstats.h>
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static unsigned *swap_refs;		/* references to each slot in use */
+static unsigned swap_nslots;
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	char *path;
+	int result;
+
+	path = kstrdup(SWAP_DEVICE);
+	if (path == NULL) {
+		panic("swap_bootstrap: out of memory\n");
+	}
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	kfree(path);
+	if (result) {
+		kprintf("swap: cannot open %s: %s; paging disabled\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap_bootstrap: VOP_STAT on %s: %s\n",
+		      SWAP_DEVICE, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; paging disabled\n",
+			SWAP_DEVICE);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_refs = kmalloc(swap_nslots * sizeof(unsigned));
+	if (swap_map == NULL || swap_refs == NULL) {
+		panic("swap_bootstrap: no memory for the slot bitmap\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+	zswap_bootstrap(swap_nslots);
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_refs[*slot] = 1;
+	}
+	spinlock_release(&swap_lock);
+
+	return result ? ENOSPC : 0;
+}
+
+void
+swap_share(unsigned slot)
+{
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_free(unsigned slot)
+{
+	bool last;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	KASSERT(swap_refs[slot] > 0);
+	last = --swap_refs[slot] == 0;
+	spinlock_release(&swap_lock);
+	if (!last) {
+		return;
+	}
+
+	/* Nobody else can get at the slot until it's unmarked. */
+	zswap_drop(slot);
+
+	spinlock_acquire(&swap_lock);
+	bitmap_unmark(swap_map, slot);
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between a frame and a slot.
+ */
+static
+int
+swap_io(paddr_t paddr, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &u);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &u);
+	}
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		kprintf("swap: short transfer on slot %u\n", slot);
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_out(paddr_t paddr, unsigned slot)
+{
+	int result;
+
+	if (zswap_store(slot, paddr)) {
+		return 0;
+	}
+	result = swap_io(paddr, slot, UIO_WRITE);
+	if (result == 0) {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+	return result;
+}
+
+int
+swap_in(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	if (zswap_load(slot, paddr)) {
+		return 0;
+	}
+	result = swap_io(paddr, slot, UIO_READ);
+	if (result == 0) {
+		vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	}
+	return result;
+}
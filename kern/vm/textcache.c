@@ -0,0 +1,178 @@
+/*
+ * Shared text page cache.
+ *
+ * A small hash table on (vnode, vaddr). Reference counts live in the
+ * coremap; the cache lock is held across looking a frame up and
+ * adding a reference to it, and across checking for the last reference
+ * and dropping it, so a frame can't be found on its way out. A frame
+ * that has been reclaimed is out of the cache while its mappers still
+ * have references; they drop them as usual, the last one finding
+ * nothing left to take out.
+ *
+ * Lock order: textcache_lock, then the coremap lock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <textcache.h>
+
+#define TEXTCACHE_BUCKETS  64
+
+struct textcache_entry {
+	struct vnode *tce_vnode;
+	vaddr_t tce_vaddr;
+	paddr_t tce_paddr;
+	struct textcache_entry *tce_next;
+};
+
+static struct spinlock textcache_lock = SPINLOCK_INITIALIZER;
+static struct textcache_entry *textcache[TEXTCACHE_BUCKETS];
+static unsigned textcache_hand;	/* bucket textcache_reclaim tries first */
+
+static
+unsigned
+textcache_hash(struct vnode *v, vaddr_t vaddr)
+{
+	return ((vaddr / PAGE_SIZE) ^ ((uintptr_t)v / sizeof(void *)))
+		% TEXTCACHE_BUCKETS;
+}
+
+/*
+ * Find the entry for VADDR in V. Call with the cache lock held.
+ */
+static
+struct textcache_entry *
+textcache_find(struct vnode *v, vaddr_t vaddr)
+{
+	struct textcache_entry *tce;
+
+	for (tce = textcache[textcache_hash(v, vaddr)]; tce != NULL;
+	     tce = tce->tce_next) {
+		if (tce->tce_vnode == v && tce->tce_vaddr == vaddr) {
+			return tce;
+		}
+	}
+	return NULL;
+}
+
+paddr_t
+textcache_lookup(struct vnode *v, vaddr_t vaddr)
+{
+	struct textcache_entry *tce;
+	paddr_t paddr = 0;
+
+	spinlock_acquire(&textcache_lock);
+	tce = textcache_find(v, vaddr);
+	if (tce != NULL) {
+		paddr = tce->tce_paddr;
+		coremap_incref(paddr);
+	}
+	spinlock_release(&textcache_lock);
+	return paddr;
+}
+
+paddr_t
+textcache_insert(struct vnode *v, vaddr_t vaddr, paddr_t paddr)
+{
+	struct textcache_entry *tce, *new;
+	unsigned bucket;
+	paddr_t theirs;
+
+	new = kmalloc(sizeof(struct textcache_entry));
+	if (new == NULL) {
+		return 0;
+	}
+
+	spinlock_acquire(&textcache_lock);
+	tce = textcache_find(v, vaddr);
+	if (tce != NULL) {
+		/* Lost the race to load it; use theirs. */
+		theirs = tce->tce_paddr;
+		coremap_incref(theirs);
+		spinlock_release(&textcache_lock);
+		coremap_free(paddr);
+		kfree(new);
+		return theirs;
+	}
+
+	bucket = textcache_hash(v, vaddr);
+	new->tce_vnode = v;
+	new->tce_vaddr = vaddr;
+	new->tce_paddr = paddr;
+	new->tce_next = textcache[bucket];
+	textcache[bucket] = new;
+	coremap_set_cached(paddr, true);
+	spinlock_release(&textcache_lock);
+	return paddr;
+}
+
+void
+textcache_release(struct vnode *v, vaddr_t vaddr, paddr_t paddr)
+{
+	struct textcache_entry *tce, **p;
+
+	spinlock_acquire(&textcache_lock);
+	if (coremap_refcount(paddr) > 1) {
+		coremap_free(paddr);
+		spinlock_release(&textcache_lock);
+		return;
+	}
+
+	/* Last mapper; out of the cache it goes, unless it's been reclaimed. */
+	for (p = &textcache[textcache_hash(v, vaddr)]; *p != NULL;
+	     p = &(*p)->tce_next) {
+		if ((*p)->tce_paddr == paddr) {
+			break;
+		}
+	}
+	tce = *p;
+	if (tce != NULL) {
+		KASSERT(tce->tce_vnode == v && tce->tce_vaddr == vaddr);
+		*p = tce->tce_next;
+		coremap_set_cached(paddr, false);
+	}
+	coremap_free(paddr);
+	spinlock_release(&textcache_lock);
+
+	if (tce != NULL) {
+		kfree(tce);
+	}
+}
+
+paddr_t
+textcache_reclaim(paddr_t paddr, vaddr_t *vaddr)
+{
+	struct textcache_entry *tce = NULL, **p = NULL;
+	unsigned i, bucket = 0;
+
+	spinlock_acquire(&textcache_lock);
+	for (i = 0; i < TEXTCACHE_BUCKETS && tce == NULL; i++) {
+		bucket = (textcache_hand + i) % TEXTCACHE_BUCKETS;
+		for (p = &textcache[bucket]; *p != NULL; p = &(*p)->tce_next) {
+			if (paddr == 0 || (*p)->tce_paddr == paddr) {
+				tce = *p;
+				break;
+			}
+		}
+	}
+	if (tce == NULL) {
+		spinlock_release(&textcache_lock);
+		return 0;
+	}
+
+	*p = tce->tce_next;
+	if (paddr == 0) {
+		textcache_hand = (bucket + 1) % TEXTCACHE_BUCKETS;
+	}
+	paddr = tce->tce_paddr;
+	*vaddr = tce->tce_vaddr;
+	coremap_set_cached(paddr, false);
+	coremap_incref(paddr);
+	spinlock_release(&textcache_lock);
+
+	kfree(tce);
+	return paddr;
+}
@@ -14,11 +14,16 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <clock.h>
+#include <vm.h>
 #include <uw-vmstats.h>
 
 /* Counters for tracking statistics */
 static unsigned int stats_counts[VMSTAT_COUNT];
 
+/* When the counters were last reset, for per-second rates */
+static time_t stats_start;
+
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
 /* Strings used in printing out the statistics */
@@ -33,6 +38,29 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "Zero Pool Hits",
+ /* 11 */ "Zero Pool Misses",
+ /* 12 */ "Fault-around Followed",
+ /* 13 */ "Fault-around Abandoned",
+ /* 14 */ "TLB Shootdowns",
+ /* 15 */ "TLB Shootdown IPIs",
+ /* 16 */ "Zero Page Hits",
+ /* 17 */ "KSM Pages Scanned",
+ /* 18 */ "KSM Pages Merged",
+ /* 19 */ "KSM Pages Unmerged",
+ /* 20 */ "Compressed Swap Stores",
+ /* 21 */ "Compressed Swap Overflows",
+ /* 22 */ "Compressed Swap Hits",
+ /* 23 */ "Compressed Swap Bytes",
+ /* 24 */ "Page-out Daemon Reclaims",
+ /* 25 */ "Direct Reclaims",
+ /* 26 */ "Clean Page Drops",
+ /* 27 */ "Compaction Migrations",
+ /* 28 */ "Compaction Successes",
+ /* 29 */ "Compaction Failures",
+ /* 30 */ "Working-set Trims",
+ /* 31 */ "Allowance Increases",
+ /* 32 */ "Allowance Decreases",
 };
 
 
@@ -46,6 +74,16 @@ vmstats_inc(unsigned int index)
     spinlock_release(&stats_lock);
 }
 
+/* ---------------------------------------------------------------------- */
+/* Assumes vmstat_init has already been called */
+void
+vmstats_add(unsigned int index, unsigned int n)
+{
+    spinlock_acquire(&stats_lock);
+      _vmstats_add(index, n);
+    spinlock_release(&stats_lock);
+}
+
 /* ---------------------------------------------------------------------- */
 void
 vmstats_init(void)
@@ -68,11 +106,20 @@ _vmstats_inc(unsigned int index)
   stats_counts[index]++;
 }
 
+/* ---------------------------------------------------------------------- */
+void
+_vmstats_add(unsigned int index, unsigned int n)
+{
+  KASSERT(index < VMSTAT_COUNT);
+  stats_counts[index] += n;
+}
+
 /* ---------------------------------------------------------------------- */
 void
 _vmstats_init(void)
 {
   int i = 0;
+  uint32_t nsecs;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
     kprintf("vmstats_init: number of stats_names = %d != VMSTAT_COUNT = %d\n",
@@ -84,6 +131,7 @@ _vmstats_init(void)
     stats_counts[i] = 0;
   }
 
+  gettime(&stats_start, &nsecs);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -102,6 +150,12 @@ vmstats_print(void)
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  int zero_pool_requests = 0;
+  int swap_reads = 0;
+  int reclaims = 0;
+  uint64_t ratio = 0;
+  time_t now;
+  uint32_t nsecs;
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -112,7 +166,9 @@ vmstats_print(void)
   free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
   disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
     stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
+  /* Swap-ins served by the compressed swap cache never reach the disk */
+  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ] +
+    stats_counts[VMSTAT_ZSWAP_HIT];
   disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
@@ -121,6 +177,11 @@ vmstats_print(void)
       tlb_faults, free_plus_replace); 
   }
 
+  /* Extra entries loaded by fault-around, on top of TLB Faults */
+  kprintf("VMSTAT TLB Faults + Fault-around Followed + Fault-around Abandoned = %d\n",
+    tlb_faults + stats_counts[VMSTAT_FAULTAROUND_FOLLOWED] +
+    stats_counts[VMSTAT_FAULTAROUND_ABANDONED]);
+
   kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) = %d\n",
     disk_plus_zeroed_plus_reload);
   if (tlb_faults != disk_plus_zeroed_plus_reload) {
@@ -128,10 +189,55 @@ vmstats_print(void)
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
+  kprintf("VMSTAT ELF File reads + Swapfile reads + Compressed Swap Hits = %d\n", elf_plus_swap_reads);
   if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
+    kprintf("WARNING: ELF File reads + Swapfile reads + Compressed Swap Hits != Page Faults (Disk) %d\n",
       elf_plus_swap_reads);
   }
+
+  zero_pool_requests = stats_counts[VMSTAT_ZERO_POOL_HIT] + stats_counts[VMSTAT_ZERO_POOL_MISS];
+  if (zero_pool_requests > 0) {
+    kprintf("VMSTAT Zero Pool hit rate = %d%%\n",
+      stats_counts[VMSTAT_ZERO_POOL_HIT] * 100 / zero_pool_requests);
+  }
+
+  /* Zero Page Hits are the Page Faults (Zeroed) that didn't need a frame */
+  if (stats_counts[VMSTAT_PAGE_FAULT_ZERO] > 0) {
+    kprintf("VMSTAT Zero-fill faults served by the zero page = %d%%\n",
+      stats_counts[VMSTAT_ZERO_PAGE_HIT] * 100 / stats_counts[VMSTAT_PAGE_FAULT_ZERO]);
+  }
+
+  /* Merged pages still sharing a frame: each saved one frame */
+  if (stats_counts[VMSTAT_KSM_SCANNED] > 0) {
+    kprintf("VMSTAT KSM frames saved = %d\n",
+      stats_counts[VMSTAT_KSM_MERGED] - stats_counts[VMSTAT_KSM_UNMERGED]);
+  }
+
+  swap_reads = stats_counts[VMSTAT_ZSWAP_HIT] + stats_counts[VMSTAT_SWAP_FILE_READ];
+  if (swap_reads > 0) {
+    kprintf("VMSTAT Compressed swap hit rate = %d%%\n",
+      stats_counts[VMSTAT_ZSWAP_HIT] * 100 / swap_reads);
+  }
+
+  /* Pages stored per byte used; same-filled pages take no bytes at all */
+  if (stats_counts[VMSTAT_ZSWAP_BYTES] > 0) {
+    ratio = (uint64_t)stats_counts[VMSTAT_ZSWAP_STORE] * PAGE_SIZE * 100 /
+      stats_counts[VMSTAT_ZSWAP_BYTES];
+    kprintf("VMSTAT Compressed swap ratio = %d.%02d:1\n", (int)(ratio / 100), (int)(ratio % 100));
+  }
+
+  /* Direct reclaims are evictions an allocating thread had to do itself */
+  reclaims = stats_counts[VMSTAT_PAGEOUT] + stats_counts[VMSTAT_PAGEOUT_DIRECT];
+  if (reclaims > 0) {
+    kprintf("VMSTAT Reclaims done by the page-out daemon = %d%%\n",
+      stats_counts[VMSTAT_PAGEOUT] * 100 / reclaims);
+  }
+
+  gettime(&now, &nsecs);
+  if (now > stats_start) {
+    kprintf("VMSTAT TLB Shootdowns per second = %d (%d IPIs per second)\n",
+      stats_counts[VMSTAT_TLB_SHOOTDOWN] / (unsigned)(now - stats_start),
+      stats_counts[VMSTAT_TLB_SHOOTDOWN_IPI] / (unsigned)(now - stats_start));
+  }
 }
 /* ---------------------------------------------------------------------- */
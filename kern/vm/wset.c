@@ -0,0 +1,129 @@
+/*
+ * Working-set estimation and page-fault-frequency control.
+ *
+ * Every WSET_INTERVAL seconds the sweep thread has the VM go through
+ * each address space's page table (vm_wset_sweep), a leaf at a time.
+ * The frames it finds used since the last sweep are the working-set
+ * estimate; the reference bits are cleared and the entries made to
+ * fault on their next use, so the following sweep sees fresh ones.
+ * That is the price of the estimate: the TLB keeps no reference bits
+ * of its own, so every resident page in use takes one more trip
+ * through vm_fault per interval than it otherwise would.
+ *
+ * wset_adjust then looks at how many frames the address space faulted
+ * in over the interval. More than WSET_PFFHIGH and its allowance is
+ * too small: it grows by that many, as long as all the allowances
+ * together still fit in the budget. Fewer than WSET_PFFLOW and it's
+ * bigger than it needs: it shrinks halfway towards the estimate.
+ * Allowances are only enforced while memory is short, meaning free
+ * frames are below the page-out low watermark or the allowances add up
+ * to more than the budget: then an address space holding more than its
+ * allowance has its unused pages paged out by the sweep, and the clock
+ * gives its pages no second chance, so whoever outgrows their allowance
+ * pays for it rather than the processes they'd otherwise take frames
+ * from. With memory to spare, pages are left where they are.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <coremap.h>
+#include <wset.h>
+#include <pageout.h>
+#include <uw-vmstats.h>
+
+/*
+ * Only the sweep thread changes these (ws_budget not at all after
+ * bootstrap), so they need no lock.
+ */
+static unsigned ws_budget;	/* frames there are for user pages */
+static unsigned ws_committed;	/* allowances at the last sweep, plus growth since */
+static unsigned ws_committing;	/* allowances adjusted so far this sweep */
+static bool ws_pressure;	/* whether this sweep enforces allowances */
+
+static
+void
+wset_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		clocksleep(WSET_INTERVAL);
+		ws_committing = 0;
+		ws_pressure = pageout_short() || ws_committed > ws_budget;
+		vm_wset_sweep();
+		ws_committed = ws_committing;
+	}
+}
+
+void
+wset_bootstrap(void)
+{
+	unsigned total, nfree;
+	int result;
+
+	coremap_stats(&total, &nfree);
+	ws_budget = nfree;
+
+	result = thread_fork("wset", NULL, wset_thread, NULL, 0);
+	if (result) {
+		panic("wset_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+}
+
+void
+wset_init(struct wset *ws)
+{
+	ws->ws_allow = ws_budget / WSET_INITDIV;
+	if (ws->ws_allow < WSET_MINALLOW) {
+		ws->ws_allow = WSET_MINALLOW;
+	}
+	ws->ws_resident = 0;
+	ws->ws_estimate = 0;
+	ws->ws_faults = 0;
+	ws->ws_cursor = 0;
+	ws->ws_sampled = 0;
+	ws->ws_used = 0;
+}
+
+unsigned
+wset_adjust(struct wset *ws, unsigned resident, unsigned referenced)
+{
+	unsigned faults = ws->ws_faults;
+	unsigned grow;
+
+	ws->ws_faults = 0;
+	ws->ws_resident = resident;
+	ws->ws_estimate = referenced;
+
+	if (faults > WSET_PFFHIGH) {
+		grow = faults;
+		if (ws_committed + grow > ws_budget) {
+			grow = ws_committed < ws_budget ? ws_budget - ws_committed : 0;
+		}
+		if (grow > 0) {
+			ws->ws_allow += grow;
+			ws_committed += grow;
+			vmstats_inc(VMSTAT_WSET_GROW);
+		}
+	}
+	else if (faults < WSET_PFFLOW && ws->ws_allow > referenced + 1 &&
+		 ws->ws_allow > WSET_MINALLOW) {
+		ws->ws_allow -= (ws->ws_allow - referenced) / 2;
+		vmstats_inc(VMSTAT_WSET_SHRINK);
+	}
+	if (ws->ws_allow < WSET_MINALLOW) {
+		ws->ws_allow = WSET_MINALLOW;
+	}
+	if (ws->ws_allow > ws_budget) {
+		ws->ws_allow = ws_budget;
+	}
+	ws_committing += ws->ws_allow;
+
+	if (!ws_pressure || resident <= ws->ws_allow) {
+		return 0;
+	}
+	return resident - ws->ws_allow;
+}
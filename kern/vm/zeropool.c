@@ -0,0 +1,110 @@
+/*
+ * Pool of pre-zeroed frames, filled by idle cpus.
+ *
+ * The frames are allocated from the coremap as usual and just parked
+ * here; they are owned by nobody, so the clock never looks at them.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zeropool.h>
+
+static struct spinlock zeropool_lock = SPINLOCK_INITIALIZER;
+static paddr_t zeropool[ZEROPOOL_MAX];
+static unsigned zeropool_count;
+static unsigned zeropool_low, zeropool_high;
+static unsigned zeropool_reserve;	/* don't fill unless more than this is free */
+static bool zeropool_filling;		/* fell below low, not yet back to high */
+
+void
+zeropool_bootstrap(void)
+{
+	unsigned total, nfree;
+
+	coremap_stats(&total, &nfree);
+	zeropool_high = total / 32;
+	if (zeropool_high > ZEROPOOL_MAX) {
+		zeropool_high = ZEROPOOL_MAX;
+	}
+	zeropool_low = zeropool_high / 4;
+	zeropool_reserve = total / ZEROPOOL_RESERVEDIV;
+	zeropool_count = 0;
+	zeropool_filling = zeropool_high > 0;
+}
+
+paddr_t
+zeropool_get(void)
+{
+	paddr_t paddr = 0;
+
+	spinlock_acquire(&zeropool_lock);
+	if (zeropool_count > 0) {
+		paddr = zeropool[--zeropool_count];
+		if (zeropool_count < zeropool_low) {
+			zeropool_filling = true;
+		}
+	}
+	spinlock_release(&zeropool_lock);
+	return paddr;
+}
+
+bool
+zeropool_fill(void)
+{
+	unsigned total, nfree;
+	paddr_t paddr;
+
+	/*
+	 * Unlocked look first, since the idle loop calls this all the
+	 * time. Getting it wrong only means one frame too many or too few.
+	 */
+	if (!zeropool_filling || !coremap_isready()) {
+		return false;
+	}
+
+	coremap_stats(&total, &nfree);
+	if (nfree <= zeropool_reserve) {
+		return false;
+	}
+	paddr = coremap_alloc(1);
+	if (paddr == 0) {
+		return false;
+	}
+	bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+	spinlock_acquire(&zeropool_lock);
+	if (zeropool_count < zeropool_high) {
+		zeropool[zeropool_count++] = paddr;
+		paddr = 0;
+	}
+	if (zeropool_count >= zeropool_high) {
+		zeropool_filling = false;
+	}
+	spinlock_release(&zeropool_lock);
+
+	if (paddr != 0) {
+		/* Somebody else filled it first. */
+		coremap_free(paddr);
+	}
+	return true;
+}
+
+unsigned
+zeropool_drain(void)
+{
+	paddr_t frames[ZEROPOOL_MAX];
+	unsigned n;
+
+	spinlock_acquire(&zeropool_lock);
+	n = zeropool_count;
+	memcpy(frames, zeropool, n * sizeof(paddr_t));
+	zeropool_count = 0;
+	zeropool_filling = true;
+	spinlock_release(&zeropool_lock);
+
+	coremap_free_batch(frames, n);
+	return n;
+}
@@ -0,0 +1,482 @@
+/*
+ * Compressed swap cache.
+ *
+ * The arena is a set of frames cut into ZSWAP_CHUNK-byte chunks. A
+ * compressed page is kept in a chain of chunks, linked (like the free
+ * chunks) through zswap_next. Each swap slot has an entry saying
+ * whether and how it's cached here.
+ *
+ * Frames are added one at a time when a store doesn't find enough free
+ * chunks, up to zswap_maxframes, and the arena's frames are always the
+ * first zswap_nframes of zswap_frames. When the last cached page is
+ * dropped they all go back to the coremap at once; finding a frame's
+ * chunks on the free list to give back frames one by one would cost
+ * more than allocating them again.
+ *
+ * The compressor is a small LZ77 variant that works on one page. The
+ * output is a sequence of tokens, each starting with a control byte C:
+ *
+ *    C < 0x80   C+1 literal bytes follow.
+ *    C >= 0x80  copy (C & 0x7f) + ZSWAP_MINMATCH bytes from OFFSET+1
+ *               bytes back in the output; OFFSET follows in two
+ *               bytes, low byte first. The copy may overlap itself,
+ *               which is how runs come out.
+ *
+ * Compressing and decompressing are done in scratch space, of which
+ * there are ZSWAP_NSCRATCH sets, each under its own sleep lock. A
+ * thread uses the set for the cpu it's on, so cpus only wait for each
+ * other if there are more cpus than sets. zswap_lock, a spinlock, only
+ * covers the slot entries and the free chunk list; swap_free calls
+ * zswap_drop with an address space lock held, so it can't be anything
+ * else. A slot's chunks belong to whoever is paging it in or out until
+ * zswap_drop, so they are filled and read without zswap_lock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <current.h>
+#include <cpu.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zswap.h>
+#include <uw-vmstats.h>
+
+#define ZSWAP_CHUNK       128
+#define ZSWAP_PERPAGE     (PAGE_SIZE / ZSWAP_CHUNK)
+#define ZSWAP_NONE        0xffff	/* end of a chunk chain */
+#define ZSWAP_MAXCHUNKS   ZSWAP_NONE
+#define ZSWAP_MAXLEN      (PAGE_SIZE * 3 / 4)	/* else not worth keeping */
+
+#define ZSWAP_MINMATCH    4
+#define ZSWAP_MAXMATCH    (0x7f + ZSWAP_MINMATCH)
+#define ZSWAP_MAXLITERAL  0x80
+#define ZSWAP_HASHBITS    10
+#define ZSWAP_NSCRATCH    4
+
+/* ze_len values other than a compressed length */
+#define ZSWAP_EMPTY       0		/* slot not cached */
+#define ZSWAP_FILLED      0xffff	/* every word of the page is ze_fill */
+
+struct zswap_entry {
+	uint32_t ze_fill;
+	uint16_t ze_len;
+	uint16_t ze_head;		/* first chunk */
+};
+
+static struct zswap_entry *zswap_entries;	/* one per swap slot */
+static unsigned zswap_nslots;
+
+static paddr_t *zswap_frames;		/* the arena */
+static unsigned zswap_nframes;
+static unsigned zswap_maxframes;
+static uint16_t *zswap_next;		/* chunk links */
+static uint16_t zswap_free;		/* free chunk list */
+static unsigned zswap_nfree;
+
+struct zswap_scratch {
+	struct lock *zs_lock;
+	uint8_t *zs_buf;		/* compressed page */
+	uint16_t *zs_hash;		/* position + 1 */
+};
+static struct zswap_scratch zswap_scratch[ZSWAP_NSCRATCH];
+
+static struct spinlock zswap_lock = SPINLOCK_INITIALIZER;
+
+void
+zswap_bootstrap(unsigned nslots)
+{
+	unsigned total, nfree, nframes, nchunks, i;
+
+	coremap_stats(&total, &nfree);
+	nframes = total * ZSWAP_PERCENT / 100;
+	if (nframes > ZSWAP_MAXCHUNKS / ZSWAP_PERPAGE) {
+		nframes = ZSWAP_MAXCHUNKS / ZSWAP_PERPAGE;
+	}
+	nchunks = nframes * ZSWAP_PERPAGE;
+	zswap_maxframes = nframes;
+
+	zswap_entries = kmalloc(nslots * sizeof(struct zswap_entry));
+	zswap_frames = kmalloc(nframes * sizeof(paddr_t));
+	zswap_next = kmalloc(nchunks * sizeof(uint16_t));
+	if (zswap_entries == NULL || zswap_frames == NULL || zswap_next == NULL) {
+		panic("zswap_bootstrap: out of memory\n");
+	}
+	bzero(zswap_entries, nslots * sizeof(struct zswap_entry));
+	zswap_nslots = nslots;
+
+	for (i = 0; i < ZSWAP_NSCRATCH; i++) {
+		zswap_scratch[i].zs_lock = lock_create("zswap");
+		zswap_scratch[i].zs_buf = kmalloc(PAGE_SIZE);
+		zswap_scratch[i].zs_hash = kmalloc((1 << ZSWAP_HASHBITS) * sizeof(uint16_t));
+		if (zswap_scratch[i].zs_lock == NULL || zswap_scratch[i].zs_buf == NULL ||
+		    zswap_scratch[i].zs_hash == NULL) {
+			panic("zswap_bootstrap: out of memory\n");
+		}
+	}
+
+	zswap_nframes = 0;
+	zswap_free = ZSWAP_NONE;
+	zswap_nfree = 0;
+
+	kprintf("zswap: up to %u pages of compressed swap cache\n", nframes);
+}
+
+/*
+ * Add a frame to the arena, if it is under its cap and the coremap has
+ * one to spare. Lock not held.
+ */
+static
+void
+zswap_grow(void)
+{
+	paddr_t paddr;
+	unsigned first, i;
+
+	paddr = coremap_alloc(1);
+	if (paddr == 0) {
+		return;
+	}
+
+	spinlock_acquire(&zswap_lock);
+	if (zswap_nframes == zswap_maxframes) {
+		//somebody else grew it first
+		spinlock_release(&zswap_lock);
+		coremap_free(paddr);
+		return;
+	}
+	zswap_frames[zswap_nframes] = paddr;
+	first = zswap_nframes * ZSWAP_PERPAGE;
+	for (i = first + ZSWAP_PERPAGE; i-- > first; ) {
+		zswap_next[i] = zswap_free;
+		zswap_free = i;
+	}
+	zswap_nfree += ZSWAP_PERPAGE;
+	zswap_nframes++;
+	spinlock_release(&zswap_lock);
+}
+
+/*
+ * Give every frame of the arena back, once no chunk is in use. Lock
+ * held; coremap_free only takes spinlocks of its own.
+ */
+static
+void
+zswap_shrink(void)
+{
+	KASSERT(zswap_nfree == zswap_nframes * ZSWAP_PERPAGE);
+
+	while (zswap_nframes > 0) {
+		zswap_nframes--;
+		coremap_free(zswap_frames[zswap_nframes]);
+	}
+	zswap_free = ZSWAP_NONE;
+	zswap_nfree = 0;
+}
+
+/*
+ * Lock and hand back the scratch space for the cpu we're on.
+ */
+static
+struct zswap_scratch *
+zswap_scratch_get(void)
+{
+	struct zswap_scratch *zs = &zswap_scratch[curcpu->c_number % ZSWAP_NSCRATCH];
+
+	lock_acquire(zs->zs_lock);
+	return zs;
+}
+
+static
+uint8_t *
+zswap_chunk(unsigned chunk)
+{
+	return (uint8_t *)PADDR_TO_KVADDR(zswap_frames[chunk / ZSWAP_PERPAGE]) +
+		(chunk % ZSWAP_PERPAGE) * ZSWAP_CHUNK;
+}
+
+static
+unsigned
+zswap_hashat(const uint8_t *p)
+{
+	uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+
+	return (v * 2654435761U) >> (32 - ZSWAP_HASHBITS);
+}
+
+/*
+ * Emit literals SRC[START..END) at *OUT. False if they won't fit in
+ * MAX bytes of DST.
+ */
+static
+bool
+zswap_literals(const uint8_t *src, unsigned start, unsigned end,
+	       uint8_t *dst, unsigned *out, unsigned max)
+{
+	unsigned n;
+
+	while (start < end) {
+		n = end - start;
+		if (n > ZSWAP_MAXLITERAL) {
+			n = ZSWAP_MAXLITERAL;
+		}
+		if (*out + 1 + n > max) {
+			return false;
+		}
+		dst[(*out)++] = n - 1;
+		memcpy(dst + *out, src + start, n);
+		*out += n;
+		start += n;
+	}
+	return true;
+}
+
+/*
+ * Compress a page into DST, using HASH (1 << ZSWAP_HASHBITS entries)
+ * to find matches. Returns the length, or 0 if it comes to more than
+ * MAX bytes.
+ */
+static
+unsigned
+zswap_compress(const uint8_t *src, uint8_t *dst, unsigned max, uint16_t *hash)
+{
+	unsigned in, out, lit, cand, len, offset, h;
+
+	bzero(hash, (1 << ZSWAP_HASHBITS) * sizeof(uint16_t));
+	in = out = lit = 0;
+	while (in + ZSWAP_MINMATCH <= PAGE_SIZE) {
+		h = zswap_hashat(src + in);
+		cand = hash[h];
+		hash[h] = in + 1;
+		if (cand == 0 || memcmp(src + cand - 1, src + in, ZSWAP_MINMATCH) != 0) {
+			in++;
+			continue;
+		}
+		cand--;
+		len = ZSWAP_MINMATCH;
+		while (in + len < PAGE_SIZE && len < ZSWAP_MAXMATCH &&
+		       src[cand + len] == src[in + len]) {
+			len++;
+		}
+
+		if (!zswap_literals(src, lit, in, dst, &out, max) || out + 3 > max) {
+			return 0;
+		}
+		offset = in - cand - 1;
+		dst[out++] = 0x80 | (len - ZSWAP_MINMATCH);
+		dst[out++] = offset & 0xff;
+		dst[out++] = offset >> 8;
+		in += len;
+		lit = in;
+	}
+	if (!zswap_literals(src, lit, PAGE_SIZE, dst, &out, max)) {
+		return 0;
+	}
+	return out;
+}
+
+/*
+ * Undo zswap_compress. The input is our own, so anything off about it
+ * means memory has been scribbled on.
+ */
+static
+void
+zswap_decompress(const uint8_t *src, unsigned len, uint8_t *dst)
+{
+	unsigned in, out, n, offset;
+
+	in = out = 0;
+	while (in < len) {
+		if (src[in] < 0x80) {
+			n = src[in++] + 1;
+			KASSERT(in + n <= len && out + n <= PAGE_SIZE);
+			memcpy(dst + out, src + in, n);
+			in += n;
+			out += n;
+			continue;
+		}
+		n = (src[in++] & 0x7f) + ZSWAP_MINMATCH;
+		KASSERT(in + 2 <= len);
+		offset = (src[in] | src[in + 1] << 8) + 1;
+		in += 2;
+		KASSERT(offset <= out && out + n <= PAGE_SIZE);
+		for (; n > 0; n--, out++) {
+			dst[out] = dst[out - offset];
+		}
+	}
+	KASSERT(out == PAGE_SIZE);
+}
+
+/*
+ * Whether the page is one word over and over, and if so which.
+ */
+static
+bool
+zswap_samefilled(const uint32_t *words, uint32_t *fill)
+{
+	for (unsigned i = 1; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (words[i] != words[0]) {
+			return false;
+		}
+	}
+	*fill = words[0];
+	return true;
+}
+
+/*
+ * Give ZE's chunks back, and the arena's frames too if that was the
+ * last of them. Lock held.
+ */
+static
+void
+zswap_release(struct zswap_entry *ze)
+{
+	uint16_t chunk, next;
+
+	if (ze->ze_len != ZSWAP_FILLED) {
+		for (chunk = ze->ze_head; chunk != ZSWAP_NONE; chunk = next) {
+			next = zswap_next[chunk];
+			zswap_next[chunk] = zswap_free;
+			zswap_free = chunk;
+			zswap_nfree++;
+		}
+		if (zswap_nfree == zswap_nframes * ZSWAP_PERPAGE) {
+			zswap_shrink();
+		}
+	}
+	ze->ze_len = ZSWAP_EMPTY;
+}
+
+bool
+zswap_store(unsigned slot, paddr_t paddr)
+{
+	const void *page = (const void *)PADDR_TO_KVADDR(paddr);
+	struct zswap_entry *ze;
+	struct zswap_scratch *zs;
+	unsigned len, nchunks, done, n;
+	uint16_t head, *link;
+	uint32_t fill;
+
+	if (zswap_entries == NULL) {
+		return false;
+	}
+	KASSERT(slot < zswap_nslots);
+	ze = &zswap_entries[slot];
+
+	if (zswap_samefilled(page, &fill)) {
+		spinlock_acquire(&zswap_lock);
+		KASSERT(ze->ze_len == ZSWAP_EMPTY);
+		ze->ze_fill = fill;
+		ze->ze_len = ZSWAP_FILLED;
+		spinlock_release(&zswap_lock);
+		vmstats_inc(VMSTAT_ZSWAP_STORE);
+		return true;
+	}
+
+	zs = zswap_scratch_get();
+	len = zswap_compress(page, zs->zs_buf, ZSWAP_MAXLEN, zs->zs_hash);
+	nchunks = DIVROUNDUP(len, ZSWAP_CHUNK);
+
+	spinlock_acquire(&zswap_lock);
+	if (len != 0 && nchunks > zswap_nfree && zswap_nframes < zswap_maxframes) {
+		//a page never needs more than one frame's worth of chunks
+		spinlock_release(&zswap_lock);
+		zswap_grow();
+		spinlock_acquire(&zswap_lock);
+	}
+	KASSERT(ze->ze_len == ZSWAP_EMPTY);
+	if (len == 0 || nchunks > zswap_nfree) {
+		spinlock_release(&zswap_lock);
+		lock_release(zs->zs_lock);
+		vmstats_inc(VMSTAT_ZSWAP_OVERFLOW);
+		return false;
+	}
+	//take the chunks off the free list here, fill them in below
+	link = &head;
+	for (n = 0; n < nchunks; n++) {
+		*link = zswap_free;
+		zswap_free = zswap_next[zswap_free];
+		link = &zswap_next[*link];
+	}
+	*link = ZSWAP_NONE;
+	zswap_nfree -= nchunks;
+	spinlock_release(&zswap_lock);
+
+	link = &head;
+	for (done = 0; done < len; done += n) {
+		n = len - done < ZSWAP_CHUNK ? len - done : ZSWAP_CHUNK;
+		memcpy(zswap_chunk(*link), zs->zs_buf + done, n);
+		link = &zswap_next[*link];
+	}
+	lock_release(zs->zs_lock);
+
+	spinlock_acquire(&zswap_lock);
+	ze->ze_head = head;
+	ze->ze_len = len;
+	spinlock_release(&zswap_lock);
+
+	vmstats_inc(VMSTAT_ZSWAP_STORE);
+	vmstats_add(VMSTAT_ZSWAP_BYTES, len);
+	return true;
+}
+
+bool
+zswap_load(unsigned slot, paddr_t paddr)
+{
+	uint32_t *page = (uint32_t *)PADDR_TO_KVADDR(paddr);
+	struct zswap_entry *ze;
+	struct zswap_scratch *zs;
+	unsigned done, n, len;
+	uint16_t chunk;
+	uint32_t fill;
+
+	if (zswap_entries == NULL) {
+		return false;
+	}
+	KASSERT(slot < zswap_nslots);
+	ze = &zswap_entries[slot];
+
+	spinlock_acquire(&zswap_lock);
+	len = ze->ze_len;
+	chunk = ze->ze_head;
+	fill = ze->ze_fill;
+	spinlock_release(&zswap_lock);
+
+	if (len == ZSWAP_EMPTY) {
+		return false;
+	}
+	if (len == ZSWAP_FILLED) {
+		for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+			page[i] = fill;
+		}
+	}
+	else {
+		zs = zswap_scratch_get();
+		for (done = 0; done < len; done += n) {
+			n = len - done < ZSWAP_CHUNK ? len - done : ZSWAP_CHUNK;
+			memcpy(zs->zs_buf + done, zswap_chunk(chunk), n);
+			chunk = zswap_next[chunk];
+		}
+		zswap_decompress(zs->zs_buf, len, (uint8_t *)page);
+		lock_release(zs->zs_lock);
+	}
+
+	vmstats_inc(VMSTAT_ZSWAP_HIT);
+	return true;
+}
+
+void
+zswap_drop(unsigned slot)
+{
+	if (zswap_entries == NULL) {
+		return;
+	}
+	KASSERT(slot < zswap_nslots);
+
+	spinlock_acquire(&zswap_lock);
+	if (zswap_entries[slot].ze_len != ZSWAP_EMPTY) {
+		zswap_release(&zswap_entries[slot]);
+	}
+	spinlock_release(&zswap_lock);
+}
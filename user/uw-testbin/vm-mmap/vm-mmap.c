@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (32)
+#define SIZE      (PAGE_SIZE * PAGES / sizeof(int))
+#define PER_PAGE  (PAGE_SIZE / sizeof(int))
+
+int
+main()
+{
+	unsigned int *array;
+	unsigned int *again;
+	unsigned int i = 0;
+
+	array = mmap(NULL, PAGE_SIZE * PAGES, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (array == MAP_FAILED) {
+		printf("FAILED mmap\n");
+		exit(1);
+	}
+
+	/* anonymous memory starts out zeroed */
+	for (i=0; i<SIZE; i++) {
+		if (array[i] != 0) {
+			printf("FAILED new array[%d] = %u != 0\n", i, array[i]);
+			exit(1);
+		}
+	}
+	for (i=0; i<SIZE; i++) {
+		array[i] = i;
+	}
+
+	/* punch a hole in the middle; both ends must survive it */
+	if (munmap(array + 8 * PER_PAGE, PAGE_SIZE * 8) != 0) {
+		printf("FAILED munmap of the middle\n");
+		exit(1);
+	}
+	for (i=0; i<SIZE; i++) {
+		if (i >= 8 * PER_PAGE && i < 16 * PER_PAGE) {
+			continue;
+		}
+		if (array[i] != i) {
+			printf("FAILED array[%d] = %u != %d\n", i, array[i], i);
+			exit(1);
+		}
+	}
+
+	/* map the hole again in place: it comes back zeroed */
+	again = mmap(array + 8 * PER_PAGE, PAGE_SIZE * 8, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0);
+	if (again != array + 8 * PER_PAGE) {
+		printf("FAILED MAP_FIXED gave %p, wanted %p\n", again, array + 8 * PER_PAGE);
+		exit(1);
+	}
+	for (i=8 * PER_PAGE; i<16 * PER_PAGE; i++) {
+		if (array[i] != 0) {
+			printf("FAILED remapped array[%d] = %u != 0\n", i, array[i]);
+			exit(1);
+		}
+	}
+
+	/* and overlapping an existing mapping must fail */
+	if (mmap(array, PAGE_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANON | MAP_FIXED,
+		 -1, 0) != MAP_FAILED) {
+		printf("FAILED MAP_FIXED over an existing mapping\n");
+		exit(1);
+	}
+
+	if (munmap(array, PAGE_SIZE * PAGES) != 0) {
+		printf("FAILED munmap of the whole thing\n");
+		exit(1);
+	}
+
+	/* the stack isn't ours to unmap */
+	if (munmap((void *)((unsigned)&i & ~(PAGE_SIZE - 1)), PAGE_SIZE) == 0) {
+		printf("FAILED munmap of the stack\n");
+		exit(1);
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
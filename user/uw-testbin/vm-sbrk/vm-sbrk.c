@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (64)
+#define SIZE      (PAGE_SIZE * PAGES / sizeof(int))
+
+int
+main()
+{
+	unsigned int *array;
+	unsigned int i = 0;
+	char *base, *top;
+	char *block;
+
+	base = sbrk(0);
+
+	/* grow the heap and use all of it */
+	array = sbrk(PAGE_SIZE * PAGES);
+	if (array == (void *)-1 || (char *)array != base) {
+		printf("FAILED sbrk grow returned %p, break was %p\n", array, base);
+		exit(1);
+	}
+	for (i=0; i<SIZE; i++) {
+		array[i] = i;
+	}
+	for (i=0; i<SIZE; i++) {
+		if (array[i] != i) {
+			printf("FAILED array[%d] = %u != %d\n", i, array[i], i);
+			exit(1);
+		}
+	}
+
+	/* give back the top half, then take it again: it must come back zeroed */
+	if (sbrk(-(PAGE_SIZE * PAGES / 2)) == (void *)-1) {
+		printf("FAILED sbrk shrink\n");
+		exit(1);
+	}
+	top = sbrk(0);
+	if (top != base + PAGE_SIZE * PAGES / 2) {
+		printf("FAILED break is %p after shrink, expected %p\n", top,
+		       base + PAGE_SIZE * PAGES / 2);
+		exit(1);
+	}
+	if (sbrk(PAGE_SIZE * PAGES / 2) == (void *)-1) {
+		printf("FAILED sbrk regrow\n");
+		exit(1);
+	}
+	for (i=0; i<SIZE/2; i++) {
+		if (array[i] != i) {
+			printf("FAILED kept array[%d] = %u != %d\n", i, array[i], i);
+			exit(1);
+		}
+	}
+	for (i=SIZE/2; i<SIZE; i++) {
+		if (array[i] != 0) {
+			printf("FAILED regrown array[%d] = %u != 0\n", i, array[i]);
+			exit(1);
+		}
+	}
+
+	/* shrinking below where the heap started must fail */
+	if (sbrk(-(PAGE_SIZE * PAGES * 2)) != (void *)-1) {
+		printf("FAILED sbrk shrank below the start of the heap\n");
+		exit(1);
+	}
+
+	/* and malloc, which sits on top of sbrk, must work */
+	block = malloc(PAGE_SIZE * 4);
+	if (block == NULL) {
+		printf("FAILED malloc\n");
+		exit(1);
+	}
+	for (i=0; i<PAGE_SIZE * 4; i++) {
+		block[i] = (char)i;
+	}
+	free(block);
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
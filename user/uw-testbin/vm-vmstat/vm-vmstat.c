@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (32)
+
+static
+unsigned
+histtotal(const struct vmstat *vs)
+{
+	unsigned i, total = 0;
+
+	for (i=0; i<VS_HISTBUCKETS; i++) {
+		total += vs->vs_faulthist[i];
+	}
+	return total;
+}
+
+static
+void
+getstats(struct vmstat *vs)
+{
+	if (getvmstat(vs) != 0) {
+		printf("FAILED getvmstat\n");
+		exit(1);
+	}
+}
+
+int
+main()
+{
+	struct vmstat before, after;
+	char *pages;
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	pages = sbrk(PAGE_SIZE * PAGES);
+	if (pages == (void *)-1) {
+		printf("FAILED sbrk\n");
+		exit(1);
+	}
+
+	/* every page is new, so each write is a zero-fill fault */
+	getstats(&before);
+	for (i=0; i<PAGES; i++) {
+		pages[i * PAGE_SIZE] = (char)i;
+	}
+	getstats(&after);
+	if (after.vs_zerofaults - before.vs_zerofaults < PAGES) {
+		printf("FAILED %u zero-fill faults for %d new pages\n",
+		       after.vs_zerofaults - before.vs_zerofaults, PAGES);
+		exit(1);
+	}
+	if (after.vs_tlbmisses - before.vs_tlbmisses < PAGES) {
+		printf("FAILED %u TLB misses for %d new pages\n",
+		       after.vs_tlbmisses - before.vs_tlbmisses, PAGES);
+		exit(1);
+	}
+	if (histtotal(&after) - histtotal(&before) < PAGES) {
+		printf("FAILED %u faults timed for %d new pages\n",
+		       histtotal(&after) - histtotal(&before), PAGES);
+		exit(1);
+	}
+	if (after.vs_resident == 0) {
+		printf("FAILED no pages resident\n");
+		exit(1);
+	}
+
+	/*
+	 * after fork the child's writes have to copy the pages (all but
+	 * any that were in swap, which the child reads back in instead)
+	 */
+	pid = fork();
+	if (pid < 0) {
+		printf("FAILED fork\n");
+		exit(1);
+	}
+	if (pid == 0) {
+		getstats(&before);
+		for (i=0; i<PAGES; i++) {
+			pages[i * PAGE_SIZE]++;
+		}
+		getstats(&after);
+		if (after.vs_cowbreaks == before.vs_cowbreaks) {
+			printf("FAILED no copy-on-write breaks for %d pages\n", PAGES);
+			_exit(1);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		printf("FAILED waitpid\n");
+		exit(1);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		exit(1);
+	}
+
+	getstats(&after);
+	if (after.vs_wsallow == 0) {
+		printf("FAILED no resident-frame allowance\n");
+		exit(1);
+	}
+	printf("resident %u, working set %u, allowance %u\n",
+	       after.vs_resident, after.vs_wsestimate, after.vs_wsallow);
+	printf("faults: zero %u file %u swap %u, TLB misses %u, COW breaks %u\n",
+	       after.vs_zerofaults, after.vs_filefaults, after.vs_swapfaults,
+	       after.vs_tlbmisses, after.vs_cowbreaks);
+	for (i=0; i<VS_HISTBUCKETS; i++) {
+		if (after.vs_faulthist[i] != 0) {
+			printf("  %u+ cycles: %u\n", 1u << i, after.vs_faulthist[i]);
+		}
+	}
+
+	printf("SUCCEEDED\n");
+	return 0;
+}